@@ -95,6 +95,13 @@ static void ShowOptions(void)
     "  -y  -windowfx      Handle the 'One-Sided Window' trick\n"
     "  -u  -prunesec      Remove unused sectors\n"
     "  -b  -maxblock ###  Sets the BLOCKMAP truncation limit\n"
+    "  -bt -blocktail     Share the tails of BLOCKMAP line lists\n"
+    "  -bz -blocknozero   Allow BLOCKMAP without zeros (vanilla only)\n"
+    "  -j  -threads ###   Number of threads to use (1 = none)\n"
+    "  -zlevel ###        Compression of ZDoom nodes (0 = store)\n"
+    "  -reject xxx        REJECT effort: fast, normal or full\n"
+    "  -rejectdist ###    REJECT sectors further apart than this\n"
+    "  -strategy xxx      Partition choice: normal or boundary\n"
     "  -xn -nonormal      Don't add (if missing) the normal nodes\n"
     "  -xp -noprog        Don't show progress indicator\n"
     "  -xu -noprune       Never prune linedefs or sidedefs\n"
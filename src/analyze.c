@@ -55,6 +55,194 @@ extern sector_t  ** lev_sectors;
 extern boolean_g lev_doing_normal;
 
 
+/* ----- linedef index ----------------------------- */
+
+// the polyobj and window effect tests need to find the linedefs
+// near a given spot, which would mean scanning every linedef for
+// every query.  Hence we put the linedefs into a coarse grid once
+// (each one goes into every cell its bounding box touches) and only
+// look in the cells that a query box overlaps.
+
+#define LINE_INDEX_CELL       256
+#define LINE_INDEX_MAX_CELLS  (1 << 18)
+
+static int line_grid_x, line_grid_y;
+static int line_grid_w, line_grid_h;
+static int line_cell_size;
+
+// cell contents, start offsets have one extra entry at the end
+static int *line_cell_start = NULL;
+static int *line_cell_list  = NULL;
+
+// query results, and stamps to avoid returning a linedef twice
+static int *line_found  = NULL;
+static int *line_stamps = NULL;
+static int line_cur_stamp;
+
+static INLINE_G int LineCellX(float_g x)
+{
+  int cx = (int) floor((x - line_grid_x) / line_cell_size);
+
+  return MAX(0, MIN(line_grid_w - 1, cx));
+}
+
+static INLINE_G int LineCellY(float_g y)
+{
+  int cy = (int) floor((y - line_grid_y) / line_cell_size);
+
+  return MAX(0, MIN(line_grid_h - 1, cy));
+}
+
+static int IndexCompare(const void *p1, const void *p2)
+{
+  return ((const int *) p1)[0] - ((const int *) p2)[0];
+}
+
+//
+// CreateLineIndex
+//
+void CreateLineIndex(void)
+{
+  int x1 = INT_MAX, y1 = INT_MAX;
+  int x2 = INT_MIN, y2 = INT_MIN;
+
+  int pass, i, cx, cy;
+  int *fill = NULL;
+
+  for (i=0; i < num_linedefs; i++)
+  {
+    linedef_t *L = lev_linedefs[i];
+
+    x1 = MIN(x1, (int) floor(MIN(L->start->x, L->end->x)));
+    y1 = MIN(y1, (int) floor(MIN(L->start->y, L->end->y)));
+    x2 = MAX(x2, (int) ceil (MAX(L->start->x, L->end->x)));
+    y2 = MAX(y2, (int) ceil (MAX(L->start->y, L->end->y)));
+  }
+
+  if (x1 > x2)
+  {
+    x1 = y1 = x2 = y2 = 0;
+  }
+
+  line_grid_x = x1;
+  line_grid_y = y1;
+
+  line_cell_size = LINE_INDEX_CELL;
+
+  for (;;)
+  {
+    line_grid_w = (x2 - x1) / line_cell_size + 1;
+    line_grid_h = (y2 - y1) / line_cell_size + 1;
+
+    if ((double) line_grid_w * line_grid_h <= LINE_INDEX_MAX_CELLS)
+      break;
+
+    line_cell_size *= 2;
+  }
+
+  line_cell_start = UtilCalloc((line_grid_w * line_grid_h + 1) * sizeof(int));
+
+  for (pass=0; pass < 2; pass++)
+  {
+    if (pass == 1)
+    {
+      for (i=0; i < line_grid_w * line_grid_h; i++)
+        line_cell_start[i+1] += line_cell_start[i];
+
+      line_cell_list = UtilCalloc(MAX(1, line_cell_start[i]) * sizeof(int));
+
+      fill = UtilCalloc(line_grid_w * line_grid_h * sizeof(int));
+    }
+
+    for (i=0; i < num_linedefs; i++)
+    {
+      linedef_t *L = lev_linedefs[i];
+
+      int lx1 = LineCellX(MIN(L->start->x, L->end->x));
+      int ly1 = LineCellY(MIN(L->start->y, L->end->y));
+      int lx2 = LineCellX(MAX(L->start->x, L->end->x));
+      int ly2 = LineCellY(MAX(L->start->y, L->end->y));
+
+      for (cy=ly1; cy <= ly2; cy++)
+      for (cx=lx1; cx <= lx2; cx++)
+      {
+        int cell = cy * line_grid_w + cx;
+
+        if (pass == 0)
+          line_cell_start[cell + 1] += 1;
+        else
+          line_cell_list[line_cell_start[cell] + fill[cell]++] = i;
+      }
+    }
+  }
+
+  UtilFree(fill);
+
+  line_found  = UtilCalloc(MAX(1, num_linedefs) * sizeof(int));
+  line_stamps = UtilCalloc(MAX(1, num_linedefs) * sizeof(int));
+
+  line_cur_stamp = 0;
+}
+
+//
+// FreeLineIndex
+//
+void FreeLineIndex(void)
+{
+  if (! line_cell_start)
+    return;
+
+  UtilFree(line_cell_start);
+  UtilFree(line_cell_list);
+  UtilFree(line_found);
+  UtilFree(line_stamps);
+
+  line_cell_start = line_cell_list = NULL;
+  line_found = line_stamps = NULL;
+}
+
+//
+// FindLinesInBox
+//
+// Finds every linedef whose bounding box may touch the given box.
+// The result (in line_found) is sorted by linedef number, so callers
+// visit the lines in the same order as a plain scan would.
+//
+static int FindLinesInBox(float_g x1, float_g y1, float_g x2, float_g y2)
+{
+  int cx1 = LineCellX(x1);
+  int cy1 = LineCellY(y1);
+  int cx2 = LineCellX(x2);
+  int cy2 = LineCellY(y2);
+
+  int count = 0;
+  int cx, cy, j;
+
+  line_cur_stamp++;
+
+  for (cy=cy1; cy <= cy2; cy++)
+  for (cx=cx1; cx <= cx2; cx++)
+  {
+    int cell = cy * line_grid_w + cx;
+
+    for (j=line_cell_start[cell]; j < line_cell_start[cell+1]; j++)
+    {
+      int i = line_cell_list[j];
+
+      if (line_stamps[i] == line_cur_stamp)
+        continue;
+
+      line_stamps[i] = line_cur_stamp;
+      line_found[count++] = i;
+    }
+  }
+
+  qsort(line_found, count, sizeof(int), IndexCompare);
+
+  return count;
+}
+
+
 /* ----- polyobj handling ----------------------------- */
 
 static void MarkPolyobjSector(sector_t *sector)
@@ -91,7 +279,7 @@ static void MarkPolyobjSector(sector_t *sector)
 
 static void MarkPolyobjPoint(float_g x, float_g y)
 {
-  int i;
+  int k, count;
   int inside_count = 0;
  
   float_g best_dist = 999999;
@@ -110,9 +298,13 @@ static void MarkPolyobjPoint(float_g x, float_g y)
   int bmaxx = (int) (x + POLY_BOX_SZ);
   int bmaxy = (int) (y + POLY_BOX_SZ);
 
-  for (i = 0; i < num_linedefs; i++)
+  // the box test below truncates the coordinates, hence the extra
+  // unit around the box when looking for candidate lines.
+  count = FindLinesInBox(bminx - 1, bminy - 1, bmaxx + 1, bmaxy + 1);
+
+  for (k = 0; k < count; k++)
   {
-    linedef_t *L = lev_linedefs[i];
+    linedef_t *L = lev_linedefs[line_found[k]];
 
     if (CheckLinedefInsideBox(bminx, bminy, bmaxx, bmaxy,
           (int) L->start->x, (int) L->start->y,
@@ -141,9 +333,12 @@ static void MarkPolyobjPoint(float_g x, float_g y)
   //       If the point is sitting directly on a (two-sided) line,
   //       then we mark the sectors on both sides.
 
-  for (i = 0; i < num_linedefs; i++)
+  count = FindLinesInBox(line_grid_x, y - DIST_EPSILON,
+      line_grid_x + line_grid_w * line_cell_size, y + DIST_EPSILON);
+
+  for (k = 0; k < count; k++)
   {
-    linedef_t *L = lev_linedefs[i];
+    linedef_t *L = lev_linedefs[line_found[k]];
 
     float_g x_cut;
 
@@ -299,425 +494,615 @@ void DetectPolyobjSectors(void)
 
 /* ----- analysis routines ----------------------------- */
 
-static int VertexCompare(const void *p1, const void *p2)
-{
-  int vert1 = ((const uint16_g *) p1)[0];
-  int vert2 = ((const uint16_g *) p2)[0];
-
-  vertex_t *A = lev_vertices[vert1];
-  vertex_t *B = lev_vertices[vert2];
-
-  if (vert1 == vert2)
-    return 0;
+// Duplicate vertices and sidedefs are found with a hash table keyed
+// on what has to match (the integer coordinates, or the sector,
+// offsets and textures).  Each table entry is the number of the
+// first vertex or sidedef seen with that key, and any later ones
+// become equivalent to it.
 
-  if ((int)A->x != (int)B->x)
-    return (int)A->x - (int)B->x; 
-  
-  return (int)A->y - (int)B->y;
-}
+static int *dup_table;
+static int dup_size;
 
-static int SidedefCompare(const void *p1, const void *p2)
+static void DupTableInit(int max_entries)
 {
-  int comp;
+  int i;
 
-  int side1 = ((const uint16_g *) p1)[0];
-  int side2 = ((const uint16_g *) p2)[0];
+  for (dup_size = 64; dup_size < max_entries * 2; dup_size *= 2)
+  { }
 
-  sidedef_t *A = lev_sidedefs[side1];
-  sidedef_t *B = lev_sidedefs[side2];
+  dup_table = UtilCalloc(dup_size * sizeof(int));
 
-  if (side1 == side2)
-    return 0;
+  for (i=0; i < dup_size; i++)
+    dup_table[i] = -1;
+}
 
-  // don't merge sidedefs on special lines
-  if (A->on_special || B->on_special)
-    return side1 - side2;
+static unsigned int DupHashInt(unsigned int hash, int value)
+{
+  int k;
 
-  if (A->sector != B->sector)
-  {
-    if (A->sector == NULL) return -1;
-    if (B->sector == NULL) return +1;
+  for (k=0; k < 4; k++, value >>= 8)
+    hash = (hash ^ (value & 0xFF)) * 16777619U;
 
-    return (A->sector->index - B->sector->index);
-  }
+  return hash;
+}
 
-  if ((int)A->x_offset != (int)B->x_offset)
-    return A->x_offset - (int)B->x_offset;
+static unsigned int DupHashName(unsigned int hash, const char *name)
+{
+  int k;
 
-  if ((int)A->y_offset != B->y_offset)
-    return (int)A->y_offset - (int)B->y_offset;
+  for (k=0; k < 8; k++)
+    hash = (hash ^ (unsigned char) name[k]) * 16777619U;
 
-  // compare textures
+  return hash;
+}
 
-  comp = memcmp(A->upper_tex, B->upper_tex, sizeof(A->upper_tex));
-  if (comp) return comp;
-  
-  comp = memcmp(A->lower_tex, B->lower_tex, sizeof(A->lower_tex));
-  if (comp) return comp;
-  
-  comp = memcmp(A->mid_tex, B->mid_tex, sizeof(A->mid_tex));
-  if (comp) return comp;
+static INLINE_G int VertexMatch(const vertex_t *A, const vertex_t *B)
+{
+  return ((int)A->x == (int)B->x && (int)A->y == (int)B->y);
+}
 
-  // sidedefs must be the same
-  return 0;
+static int SidedefMatch(const sidedef_t *A, const sidedef_t *B)
+{
+  return (A->sector == B->sector &&
+          A->x_offset == B->x_offset &&
+          A->y_offset == B->y_offset &&
+          memcmp(A->upper_tex, B->upper_tex, sizeof(A->upper_tex)) == 0 &&
+          memcmp(A->lower_tex, B->lower_tex, sizeof(A->lower_tex)) == 0 &&
+          memcmp(A->mid_tex,   B->mid_tex,   sizeof(A->mid_tex))   == 0);
 }
 
 void DetectDuplicateVertices(void)
 {
   int i;
-  uint16_g *array = UtilCalloc(num_vertices * sizeof(uint16_g));
 
   DisplayTicker();
 
-  // sort array of indices
-  for (i=0; i < num_vertices; i++)
-    array[i] = i;
-  
-  qsort(array, num_vertices, sizeof(uint16_g), VertexCompare);
+  DupTableInit(num_vertices);
 
-  // now mark them off
-  for (i=0; i < num_vertices - 1; i++)
+  for (i=0; i < num_vertices; i++)
   {
-    // duplicate ?
-    if (VertexCompare(array + i, array + i+1) == 0)
+    vertex_t *V = lev_vertices[i];
+
+    unsigned int hash = 2166136261U;
+    int pos;
+
+    hash = DupHashInt(hash, (int)V->x);
+    hash = DupHashInt(hash, (int)V->y);
+
+    for (pos = (int)(hash & (dup_size - 1)); dup_table[pos] >= 0;
+         pos = (pos + 1) & (dup_size - 1))
     {
-      vertex_t *A = lev_vertices[array[i]];
-      vertex_t *B = lev_vertices[array[i+1]];
+      if (VertexMatch(lev_vertices[dup_table[pos]], V))
+        break;
+    }
 
+    if (dup_table[pos] < 0)
+      dup_table[pos] = i;
+    else
+    {
       // found a duplicate !
-      B->equiv = A->equiv ? A->equiv : A;
+      V->equiv = lev_vertices[dup_table[pos]];
     }
   }
 
-  UtilFree(array);
+  UtilFree(dup_table);
+  dup_table = NULL;
 }
 
 void DetectDuplicateSidedefs(void)
 {
   int i;
-  uint16_g *array = UtilCalloc(num_sidedefs * sizeof(uint16_g));
 
   DisplayTicker();
 
-  // sort array of indices
-  for (i=0; i < num_sidedefs; i++)
-    array[i] = i;
-  
-  qsort(array, num_sidedefs, sizeof(uint16_g), SidedefCompare);
+  DupTableInit(num_sidedefs);
 
-  // now mark them off
-  for (i=0; i < num_sidedefs - 1; i++)
+  for (i=0; i < num_sidedefs; i++)
   {
-    // duplicate ?
-    if (SidedefCompare(array + i, array + i+1) == 0)
+    sidedef_t *S = lev_sidedefs[i];
+
+    unsigned int hash = 2166136261U;
+    int pos;
+
+    // don't merge sidedefs on special lines
+    if (S->on_special)
+      continue;
+
+    hash = DupHashInt(hash, S->sector ? S->sector->index : -1);
+    hash = DupHashInt(hash, S->x_offset);
+    hash = DupHashInt(hash, S->y_offset);
+
+    hash = DupHashName(hash, S->upper_tex);
+    hash = DupHashName(hash, S->lower_tex);
+    hash = DupHashName(hash, S->mid_tex);
+
+    for (pos = (int)(hash & (dup_size - 1)); dup_table[pos] >= 0;
+         pos = (pos + 1) & (dup_size - 1))
     {
-      sidedef_t *A = lev_sidedefs[array[i]];
-      sidedef_t *B = lev_sidedefs[array[i+1]];
+      if (SidedefMatch(lev_sidedefs[dup_table[pos]], S))
+        break;
+    }
 
+    if (dup_table[pos] < 0)
+      dup_table[pos] = i;
+    else
+    {
       // found a duplicate !
-      B->equiv = A->equiv ? A->equiv : A;
+      S->equiv = lev_sidedefs[dup_table[pos]];
     }
   }
 
-  UtilFree(array);
+  UtilFree(dup_table);
+  dup_table = NULL;
+}
+
+//
+// PruneLevel
+//
+// Removes zero length linedefs (and makes linedefs use the first of
+// any duplicated vertices and sidedefs), then removes the vertices,
+// sidedefs and sectors which are no longer used.  The reference
+// counts are computed afresh from what is left, and a remap table
+// (old number to new number, or -1 when removed) is made for each
+// kind of object.  Each array is then compacted in one pass, which
+// also sets the new index numbers.
+//
+// Vertices are always pruned (ignoring -noprune), otherwise all the
+// unused vertices from seg splits would keep accumulating.
+//
+
+#define PRUNE_COMPACT(BASEVAR, NUMVAR, MAP)  \
+{  \
+  int i_, n_ = 0;  \
+  for (i_=0; i_ < NUMVAR; i_++)  \
+  {  \
+    if (MAP[i_] < 0)  \
+    {  \
+      UtilFree(BASEVAR[i_]);  \
+      continue;  \
+    }  \
+    BASEVAR[i_]->index = MAP[i_];  \
+    BASEVAR[n_++] = BASEVAR[i_];  \
+  }  \
+  NUMVAR = n_;  \
 }
 
-void PruneLinedefs(void)
+void PruneLevel(void)
 {
+  boolean_g prune_lines = cur_info->no_prune ? FALSE : TRUE;
+  boolean_g prune_sides = cur_info->no_prune ? FALSE : TRUE;
+  boolean_g prune_sects = cur_info->prune_sect ? TRUE : FALSE;
+
+  int *line_map = UtilCalloc(MAX(1, num_linedefs) * sizeof(int));
+  int *vert_map = UtilCalloc(MAX(1, num_vertices) * sizeof(int));
+  int *side_map = UtilCalloc(MAX(1, num_sidedefs) * sizeof(int));
+  int *sect_map = UtilCalloc(MAX(1, num_sectors)  * sizeof(int));
+
+  int new_lines = 0, new_verts = 0;
+  int new_sides = 0, new_sects = 0;
+
+  int unused_verts = 0;
+  int unused_sides = 0;
+
   int i;
-  int new_num;
 
   DisplayTicker();
 
-  // scan all linedefs
-  for (i=0, new_num=0; i < num_linedefs; i++)
+  for (i=0; i < num_vertices; i++)
+    lev_vertices[i]->ref_count = 0;
+
+  for (i=0; i < num_sidedefs; i++)
+    lev_sidedefs[i]->ref_count = 0;
+
+  for (i=0; i < num_sectors; i++)
+    lev_sectors[i]->ref_count = 0;
+
+  // linedefs, counting the references to vertices and sidedefs
+  for (i=0; i < num_linedefs; i++)
   {
     linedef_t *L = lev_linedefs[i];
 
-    // handle duplicated vertices
-    while (L->start->equiv)
+    if (prune_lines)
     {
-      L->start->ref_count--;
-      L->start = L->start->equiv;
-      L->start->ref_count++;
-    }
+      // handle duplicated vertices and sidedefs
+      while (L->start->equiv)
+        L->start = L->start->equiv;
 
-    while (L->end->equiv)
-    {
-      L->end->ref_count--;
-      L->end = L->end->equiv;
-      L->end->ref_count++;
+      while (L->end->equiv)
+        L->end = L->end->equiv;
+
+      while (L->right && L->right->equiv)
+        L->right = L->right->equiv;
+
+      while (L->left && L->left->equiv)
+        L->left = L->left->equiv;
+
+      // remove zero length lines
+      if (L->zero_len)
+      {
+        line_map[i] = -1;
+        continue;
+      }
     }
 
-    // handle duplicated sidedefs
-    while (L->right && L->right->equiv)
-    {
-      L->right->ref_count--;
-      L->right = L->right->equiv;
+    line_map[i] = new_lines++;
+
+    L->start->ref_count++;
+    L->end->ref_count++;
+
+    if (L->right)
       L->right->ref_count++;
-    }
 
-    while (L->left && L->left->equiv)
-    {
-      L->left->ref_count--;
-      L->left = L->left->equiv;
+    if (L->left)
       L->left->ref_count++;
-    }
+  }
 
-    // remove zero length lines
-    if (L->zero_len)
+  for (i=0; i < num_vertices; i++)
+  {
+    vertex_t *V = lev_vertices[i];
+
+    if (V->ref_count == 0)
     {
-      L->start->ref_count--;
-      L->end->ref_count--;
+      if (V->equiv == NULL)
+        unused_verts++;
 
-      UtilFree(L);
+      vert_map[i] = -1;
       continue;
     }
 
-    L->index = new_num;
-    lev_linedefs[new_num++] = L;
+    vert_map[i] = new_verts++;
   }
 
-  if (new_num < num_linedefs)
+  // sidedefs, counting the references to sectors
+  for (i=0; i < num_sidedefs; i++)
   {
-    PrintVerbose("Pruned %d zero-length linedefs\n", num_linedefs - new_num);
-    num_linedefs = new_num;
-  }
+    sidedef_t *S = lev_sidedefs[i];
 
-  if (new_num == 0)
-    FatalError("Couldn't find any Linedefs");
-}
+    if (prune_sides && S->ref_count == 0)
+    {
+      if (S->equiv == NULL)
+        unused_sides++;
 
-void PruneVertices(void)
-{
-  int i;
-  int new_num;
-  int unused = 0;
+      side_map[i] = -1;
+      continue;
+    }
 
-  DisplayTicker();
+    side_map[i] = new_sides++;
+
+    if (S->sector)
+      S->sector->ref_count++;
+  }
 
-  // scan all vertices
-  for (i=0, new_num=0; i < num_vertices; i++)
+  for (i=0; i < num_sectors; i++)
   {
-    vertex_t *V = lev_vertices[i];
+    sector_t *S = lev_sectors[i];
 
-    if (V->ref_count < 0)
-      InternalError("Vertex %d ref_count is %d", i, V->ref_count);
-    
-    if (V->ref_count == 0)
-    {
-      if (V->equiv == NULL)
-        unused++;
+    sect_map[i] = (prune_sects && S->ref_count == 0) ? -1 : new_sects++;
+  }
 
-      UtilFree(V);
-      continue;
-    }
+  // show what gets pruned
 
-    V->index = new_num;
-    lev_vertices[new_num++] = V;
+  if (prune_lines)
+  {
+    if (new_lines < num_linedefs)
+      PrintVerbose("Pruned %d zero-length linedefs\n", num_linedefs - new_lines);
+
+    if (new_lines == 0)
+      FatalError("Couldn't find any Linedefs");
   }
 
-  if (new_num < num_vertices)
+  if (new_verts < num_vertices)
   {
-    int dup_num = num_vertices - new_num - unused;
+    int dup_num = num_vertices - new_verts - unused_verts;
 
-    if (unused > 0)
+    if (unused_verts > 0)
       PrintVerbose("Pruned %d unused vertices "
-        "(this is normal if the nodes were built before)\n", unused);
+        "(this is normal if the nodes were built before)\n", unused_verts);
 
     if (dup_num > 0)
       PrintVerbose("Pruned %d duplicate vertices\n", dup_num);
-
-    num_vertices = new_num;
   }
 
-  if (new_num == 0)
+  if (new_verts == 0)
     FatalError("Couldn't find any Vertices");
- 
-  num_normal_vert = num_vertices;
-}
-
-void PruneSidedefs(void)
-{
-  int i;
-  int new_num;
-  int unused = 0;
-
-  DisplayTicker();
 
-  // scan all sidedefs
-  for (i=0, new_num=0; i < num_sidedefs; i++)
+  if (prune_sides)
   {
-    sidedef_t *S = lev_sidedefs[i];
-
-    if (S->ref_count < 0)
-      InternalError("Sidedef %d ref_count is %d", i, S->ref_count);
-    
-    if (S->ref_count == 0)
+    if (new_sides < num_sidedefs)
     {
-      if (S->sector)
-        S->sector->ref_count--;
+      int dup_num = num_sidedefs - new_sides - unused_sides;
 
-      if (S->equiv == NULL)
-        unused++;
+      if (unused_sides > 0)
+        PrintVerbose("Pruned %d unused sidedefs\n", unused_sides);
 
-      UtilFree(S);
-      continue;
+      if (dup_num > 0)
+        PrintVerbose("Pruned %d duplicate sidedefs\n", dup_num);
     }
 
-    S->index = new_num;
-    lev_sidedefs[new_num++] = S;
+    if (new_sides == 0)
+      FatalError("Couldn't find any Sidedefs");
   }
 
-  if (new_num < num_sidedefs)
+  if (prune_sects)
   {
-    int dup_num = num_sidedefs - new_num - unused;
+    if (new_sects < num_sectors)
+      PrintVerbose("Pruned %d unused sectors\n", num_sectors - new_sects);
 
-    if (unused > 0)
-      PrintVerbose("Pruned %d unused sidedefs\n", unused);
-
-    if (dup_num > 0)
-      PrintVerbose("Pruned %d duplicate sidedefs\n", dup_num);
-
-    num_sidedefs = new_num;
+    if (new_sects == 0)
+      FatalError("Couldn't find any Sectors");
   }
 
-  if (new_num == 0)
-    FatalError("Couldn't find any Sidedefs");
-}
-
-void PruneSectors(void)
-{
-  int i;
-  int new_num;
+  // now compact the arrays
 
-  DisplayTicker();
+  if (prune_lines)
+    PRUNE_COMPACT(lev_linedefs, num_linedefs, line_map)
 
-  // scan all sectors
-  for (i=0, new_num=0; i < num_sectors; i++)
-  {
-    sector_t *S = lev_sectors[i];
+  PRUNE_COMPACT(lev_vertices, num_vertices, vert_map)
 
-    if (S->ref_count < 0)
-      InternalError("Sector %d ref_count is %d", i, S->ref_count);
-    
-    if (S->ref_count == 0)
-    {
-      UtilFree(S);
-      continue;
-    }
+  if (prune_sides)
+    PRUNE_COMPACT(lev_sidedefs, num_sidedefs, side_map)
 
-    S->index = new_num;
-    lev_sectors[new_num++] = S;
-  }
+  if (prune_sects)
+    PRUNE_COMPACT(lev_sectors, num_sectors, sect_map)
 
-  if (new_num < num_sectors)
-  {
-    PrintVerbose("Pruned %d unused sectors\n", num_sectors - new_num);
-    num_sectors = new_num;
-  }
+  UtilFree(line_map);
+  UtilFree(vert_map);
+  UtilFree(side_map);
+  UtilFree(sect_map);
 
-  if (new_num == 0)
-    FatalError("Couldn't find any Sectors");
+  num_normal_vert = num_vertices;
 }
 
-static INLINE_G int LineVertexLowest(const linedef_t *L)
+// Overlapping lines are found by grouping the linedefs by their line
+// equation (the direction reduced to lowest terms plus the constant)
+// and by what they face, and then sweeping along each group in order
+// of the lowest end.  The part of a linedef which lies before the
+// furthest end reached so far is overlapped.  When that is all of it,
+// no segs are made for the linedef.  Otherwise segs are only made for
+// the rest.  Lines on the same line but facing different sectors (for
+// example the walls of two rooms meeting back-to-back) are kept apart.
+
+typedef struct overlap_key_s
 {
-  // returns the "lowest" vertex (normally the left-most, but if the
-  // line is vertical, then the bottom-most) => 0 for start, 1 for end.
+  int a, b;     // reduced direction, with a > 0 or (a == 0 and b > 0)
+  double c;     // a*y - b*x, the same for every point on the line
+
+  // sectors on the right and left of the reduced direction (-1 when
+  // there is no sidedef there), and whether the line is two-sided.
+  int front, back;
+  int two_sided;
 
-  return ((int)L->start->x < (int)L->end->x ||
-          ((int)L->start->x == (int)L->end->x && 
-           (int)L->start->y <  (int)L->end->y)) ? 0 : 1;
+  int lo, hi;   // extent along the line (x, or y when vertical)
+  int index;    // linedef number
+
+  // used by the sweep: where the kept part of the line begins, and
+  // the key of the previous line in the group which was kept.
+  int from;
+  int prev;
 }
+overlap_key_t;
 
-static int LineStartCompare(const void *p1, const void *p2)
+static int OverlapCompare(const void *p1, const void *p2)
 {
-  int line1 = ((const int *) p1)[0];
-  int line2 = ((const int *) p2)[0];
-
-  linedef_t *A = lev_linedefs[line1];
-  linedef_t *B = lev_linedefs[line2];
+  const overlap_key_t *A = (const overlap_key_t *) p1;
+  const overlap_key_t *B = (const overlap_key_t *) p2;
 
-  vertex_t *C;
-  vertex_t *D;
+  if (A->a != B->a)
+    return A->a - B->a;
 
-  if (line1 == line2)
-    return 0;
+  if (A->b != B->b)
+    return A->b - B->b;
 
-  // determine left-most vertex of each line
-  C = LineVertexLowest(A) ? A->end : A->start;
-  D = LineVertexLowest(B) ? B->end : B->start;
+  if (A->c != B->c)
+    return (A->c < B->c) ? -1 : +1;
 
-  if ((int)C->x != (int)D->x)
-    return (int)C->x - (int)D->x; 
+  if (A->front != B->front)
+    return A->front - B->front;
 
-  return (int)C->y - (int)D->y;
-}
+  if (A->back != B->back)
+    return A->back - B->back;
 
-static int LineEndCompare(const void *p1, const void *p2)
-{
-  int line1 = ((const int *) p1)[0];
-  int line2 = ((const int *) p2)[0];
+  if (A->two_sided != B->two_sided)
+    return A->two_sided - B->two_sided;
 
-  linedef_t *A = lev_linedefs[line1];
-  linedef_t *B = lev_linedefs[line2];
+  if (A->lo != B->lo)
+    return A->lo - B->lo;
 
-  vertex_t *C;
-  vertex_t *D;
+  return A->index - B->index;
+}
 
-  if (line1 == line2)
-    return 0;
+static INLINE_G int SameLine(const overlap_key_t *A,
+    const overlap_key_t *B)
+{
+  return (A->a == B->a && A->b == B->b && A->c == B->c);
+}
 
-  // determine right-most vertex of each line
-  C = LineVertexLowest(A) ? A->start : A->end;
-  D = LineVertexLowest(B) ? B->start : B->end;
+static INLINE_G int SameFacing(const overlap_key_t *A,
+    const overlap_key_t *B)
+{
+  return (A->front == B->front && A->back == B->back &&
+          A->two_sided == B->two_sided);
+}
 
-  if ((int)C->x != (int)D->x)
-    return (int)C->x - (int)D->x; 
+static INLINE_G int SideSector(const sidedef_t *side)
+{
+  return (side && side->sector) ? side->sector->index : -1;
+}
 
-  return (int)C->y - (int)D->y;
+static INLINE_G int IsWhole(float_g v)
+{
+  return (v == (float_g)(int) v);
 }
 
-void DetectOverlappingLines(void)
+static int MakeOverlapKey(overlap_key_t *K, const linedef_t *L)
 {
-  // Algorithm:
-  //   Sort all lines by left-most vertex.
-  //   Overlapping lines will then be near each other in this set.
-  //   Note: does not detect partially overlapping lines.
+  int x1 = (int) L->start->x;
+  int y1 = (int) L->start->y;
+  int x2 = (int) L->end->x;
+  int y2 = (int) L->end->y;
+
+  int a = x2 - x1;
+  int b = y2 - y1;
+  int g = ABS(a);
+  int h = ABS(b);
+
+  // the split points must lie exactly on the line
+  if (! (IsWhole(L->start->x) && IsWhole(L->start->y) &&
+         IsWhole(L->end->x)   && IsWhole(L->end->y)))
+    return FALSE;
+
+  if (a == 0 && b == 0)
+    return FALSE;
+
+  // greatest common divisor
+  while (h != 0)
+  {
+    int t = g % h;
 
-  int i;
-  int *array = UtilCalloc(num_linedefs * sizeof(int));
-  int count = 0;
+    g = h;
+    h = t;
+  }
 
-  DisplayTicker();
+  a /= g;
+  b /= g;
 
-  // sort array of indices
-  for (i=0; i < num_linedefs; i++)
-    array[i] = i;
-  
-  qsort(array, num_linedefs, sizeof(int), LineStartCompare);
+  K->front = SideSector(L->right);
+  K->back  = SideSector(L->left);
+
+  if (a < 0 || (a == 0 && b < 0))
+  {
+    a = -a;
+    b = -b;
+
+    K->front = SideSector(L->left);
+    K->back  = SideSector(L->right);
+  }
+
+  K->two_sided = L->two_sided ? 1 : 0;
+
+  K->a = a;
+  K->b = b;
+  K->c = (double) a * y1 - (double) b * x1;
+
+  K->lo = a ? MIN(x1, x2) : MIN(y1, y2);
+  K->hi = a ? MAX(x1, x2) : MAX(y1, y2);
+
+  K->index = L->index;
+
+  return TRUE;
+}
+
+static INLINE_G int LineCoordAt(const overlap_key_t *K, const vertex_t *V)
+{
+  return K->a ? (int) V->x : (int) V->y;
+}
+
+//
+// FindOverlapCover
+//
+// Linedef L lies entirely before the furthest end reached so far.
+// Returns the kept line whose segs cover it, following the kept lines
+// of the group backwards from 'reach_key'.  When L straddles the kept
+// parts of two lines, the one which covers its lowest end is used.
+//
+static linedef_t *FindOverlapCover(const overlap_key_t *keys,
+    const overlap_key_t *K, int reach_key)
+{
+  int j = reach_key;
+
+  while (keys[j].from > K->lo && keys[j].prev >= 0)
+    j = keys[j].prev;
+
+  return lev_linedefs[keys[j].index];
+}
 
-  for (i=0; i < num_linedefs - 1; i++)
+//
+// MarkPartOverlap
+//
+// Linedef L is overlapped from its lowest end up to vertex 'mid'.
+// Only the part beyond that gets segs.
+//
+static void MarkPartOverlap(linedef_t *L, const overlap_key_t *K,
+    vertex_t *mid)
+{
+  if (LineCoordAt(K, L->start) == K->lo)
+  {
+    L->part_start = mid;
+    L->part_end   = L->end;
+  }
+  else
+  {
+    L->part_start = L->start;
+    L->part_end   = mid;
+  }
+}
+
+void DetectOverlappingLines(void)
+{
+  int i, total = 0;
+  int count = 0;
+  int partial = 0;
+
+  // the linedef which reaches furthest along the line so far
+  linedef_t *reach_line = NULL;
+  int reach_key = -1;
+  int reach = 0;
+
+  overlap_key_t *keys = UtilCalloc(MAX(1, num_linedefs) *
+      sizeof(overlap_key_t));
+
+  DisplayTicker();
+
+  for (i=0; i < num_linedefs; i++)
   {
-    int j;
+    linedef_t *L = lev_linedefs[i];
 
-    for (j = i+1; j < num_linedefs; j++)
+    if (L->zero_len)
+      continue;
+
+    if (MakeOverlapKey(&keys[total], L))
+      total++;
+  }
+
+  qsort(keys, total, sizeof(overlap_key_t), OverlapCompare);
+
+  for (i=0; i < total; i++)
+  {
+    overlap_key_t *K = &keys[i];
+    linedef_t *L = lev_linedefs[K->index];
+
+    if (i == 0 || ! SameLine(K, &keys[i-1]) ||
+        ! SameFacing(K, &keys[i-1]) || K->lo >= reach)
     {
-      if (LineStartCompare(array + i, array + j) != 0)
-        break;
+      K->from = K->lo;
+      K->prev = -1;
 
-      if (LineEndCompare(array + i, array + j) == 0)
-      {
-        linedef_t *A = lev_linedefs[array[i]];
-        linedef_t *B = lev_linedefs[array[j]];
+      reach_line = L;
+      reach_key = i;
+      reach = K->hi;
+      continue;
+    }
 
-        // found an overlap !
-        B->overlap = A->overlap ? A->overlap : A;
+    if (K->hi <= reach)
+    {
+      // found an overlap !
+      L->overlap = FindOverlapCover(keys, K, reach_key);
 
-        count++;
-      }
+      count++;
+      continue;
     }
+
+    MarkPartOverlap(L, K, (LineCoordAt(K, reach_line->start) == reach) ?
+        reach_line->start : reach_line->end);
+
+    partial++;
+
+    K->from = reach;
+    K->prev = reach_key;
+
+    reach_line = L;
+    reach_key = i;
+    reach = K->hi;
   }
 
   if (count > 0)
@@ -725,18 +1110,25 @@ void DetectOverlappingLines(void)
       PrintVerbose("Detected %d overlapped linedefs\n", count);
   }
 
-  UtilFree(array);
+  if (partial > 0)
+  {
+      PrintVerbose("Detected %d partly overlapped linedefs\n", partial);
+  }
+
+  UtilFree(keys);
 }
 
 static void CountWallTips(vertex_t *vert, int *one_sided, int *two_sided)
 {
-    wall_tip_t *tip;
+    int k;
 
     *one_sided = 0;
     *two_sided = 0;
 
-    for (tip=vert->tip_set; tip; tip=tip->next)
+    for (k=0; k < vert->num_tips; k++)
     {
+      wall_tip_t *tip = &vert->tip_set[k];
+
       if (!tip->left || !tip->right)
         (*one_sided) += 1;
       else
@@ -747,9 +1139,10 @@ static void CountWallTips(vertex_t *vert, int *one_sided, int *two_sided)
 void TestForWindowEffect(linedef_t *L)
 {
   // cast a line horizontally or vertically and see what we hit.
-  // OUCH, we have to iterate over all linedefs.
+  // Only the linedefs in the row or column of cells along the ray
+  // need to be checked.
 
-  int i;
+  int i, k, count;
 
   float_g mx = (L->start->x + L->end->x) / 2.0;
   float_g my = (L->start->y + L->end->y) / 2.0;
@@ -767,9 +1160,16 @@ void TestForWindowEffect(linedef_t *L)
   sector_t * front_open = NULL;
   int front_line = -1;
 
-  for (i=0; i < num_linedefs; i++)
+  if (cast_horiz)
+    count = FindLinesInBox(line_grid_x, my - DIST_EPSILON,
+        line_grid_x + line_grid_w * line_cell_size, my + DIST_EPSILON);
+  else
+    count = FindLinesInBox(mx - DIST_EPSILON, line_grid_y,
+        mx + DIST_EPSILON, line_grid_y + line_grid_h * line_cell_size);
+
+  for (k=0; k < count; k++)
   {
-    linedef_t *N = lev_linedefs[i];
+    linedef_t *N;
 
     float_g dist;
     boolean_g is_front;
@@ -777,6 +1177,9 @@ void TestForWindowEffect(linedef_t *L)
 
     float_g dx2, dy2;
 
+    i = line_found[k];
+    N = lev_linedefs[i];
+
     if (N == L || N->zero_len || N->overlap)
       continue;
 
@@ -904,80 +1307,379 @@ void DetectWindowEffects(void)
 }
 
 
-/* ----- vertex routines ------------------------------- */
+/* ----- convex sectors ------------------------------- */
 
-static void VertexAddWallTip(vertex_t *vert, float_g dx, float_g dy,
-  sector_t *left, sector_t *right)
+// A sector whose linedefs form a single convex polygon (with nothing
+// inside it) never needs a partition line once its segs are on their
+// own: every seg has all the others on its right side.  PickNode uses
+// this to skip the search for such seg lists.
+//
+// To give exactly the same result as the search, the test follows
+// EvalPartition: a seg counts as lying along the partition when both
+// ends are within DIST_EPSILON of it, and then goes on the left when
+// it faces the other way.  That can happen with short pieces of two
+// edges meeting at a sharp corner, hence the minimum seg length which
+// is computed for each sector.
+
+#define CONVEX_MAX_LINES  128
+
+typedef struct convex_edge_s
 {
-  wall_tip_t *tip = NewWallTip();
-  wall_tip_t *after;
+  // the sector is on the right side going from (x1,y1) to (x2,y2)
+  float_g x1, y1, x2, y2;
+}
+convex_edge_t;
+
+//
+// CheckConvexEdges
+//
+// Returns TRUE if the edges form a convex shape, setting 'min_len'
+// to the length which each seg must be longer than.
+//
+static boolean_g CheckConvexEdges(const convex_edge_t *edges, int num,
+    float_g *min_len)
+{
+  float_g eps = DIST_EPSILON * 2;
+  int i, j;
 
-  tip->angle = UtilComputeAngle(dx, dy);
-  tip->left  = left;
-  tip->right = right;
+  *min_len = 0;
 
-  // find the correct place (order is increasing angle)
-  for (after=vert->tip_set; after && after->next; after=after->next)
-  { }
+  for (i=0; i < num; i++)
+  {
+    const convex_edge_t *E = &edges[i];
 
-  while (after && tip->angle + ANG_EPSILON < after->angle) 
-    after = after->prev;
-  
-  // link it in
-  tip->next = after ? after->next : vert->tip_set;
-  tip->prev = after;
+    float_g dx = E->x2 - E->x1;
+    float_g dy = E->y2 - E->y1;
+    float_g len = UtilComputeDist(dx, dy);
 
-  if (after)
+    for (j=0; j < num; j++)
+    {
+      const convex_edge_t *F = &edges[j];
+
+      float_g fdx = F->x2 - F->x1;
+      float_g fdy = F->y2 - F->y1;
+
+      float_g d1 = ((F->x1 - E->x1) * dy - (F->y1 - E->y1) * dx) / len;
+      float_g d2 = ((F->x2 - E->x1) * dy - (F->y2 - E->y1) * dx) / len;
+
+      if (i == j)
+        continue;
+
+      // every edge must be on the right side
+      if (d1 < 0 || d2 < 0)
+        return FALSE;
+
+      if (fdx * dx + fdy * dy >= 0)
+        continue;
+
+      // facing the other way : find how much of it is close enough
+      // to count as lying along this edge.
+
+      if (d1 <= eps && d2 <= eps)
+        return FALSE;
+
+      if (d1 <= eps || d2 <= eps)
+      {
+        float_g part = (eps - MIN(d1, d2)) / fabs(d2 - d1);
+
+        *min_len = MAX(*min_len, part * UtilComputeDist(fdx, fdy));
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+//
+// DetectConvexSectors
+//
+void DetectConvexSectors(void)
+{
+  int *start = UtilCalloc((num_sectors + 1) * sizeof(int));
+  int *fill  = UtilCalloc(MAX(1, num_sectors) * sizeof(int));
+
+  convex_edge_t *edges = NULL;
+
+  int i, pass;
+
+  DisplayTicker();
+
+  for (i=0; i < num_sectors; i++)
+    lev_sectors[i]->is_convex = FALSE;
+
+  // collect the edges of each sector, in two passes.  A linedef with
+  // the same sector on both sides gets an edge each way, which is
+  // never convex.
+
+  for (pass=0; pass < 2; pass++)
   {
-    if (after->next)
-      after->next->prev = tip;
-    
-    after->next = tip;
+    if (pass == 1)
+    {
+      for (i=0; i < num_sectors; i++)
+        start[i+1] += start[i];
+
+      edges = UtilCalloc(MAX(1, start[num_sectors]) * sizeof(convex_edge_t));
+    }
+
+    for (i=0; i < num_linedefs; i++)
+    {
+      linedef_t *L = lev_linedefs[i];
+      int side;
+
+      if (L->zero_len)
+        continue;
+
+      for (side=0; side < 2; side++)
+      {
+        sidedef_t *S = side ? L->left : L->right;
+        convex_edge_t *E;
+
+        if (! S || ! S->sector)
+          continue;
+
+        if (pass == 0)
+        {
+          start[S->sector->index + 1] += 1;
+          continue;
+        }
+
+        E = &edges[start[S->sector->index] + fill[S->sector->index]++];
+
+        E->x1 = side ? L->end->x : L->start->x;
+        E->y1 = side ? L->end->y : L->start->y;
+        E->x2 = side ? L->start->x : L->end->x;
+        E->y2 = side ? L->start->y : L->end->y;
+      }
+    }
   }
-  else
+
+  for (i=0; i < num_sectors; i++)
   {
-    if (vert->tip_set)
-      vert->tip_set->prev = tip;
-    
-    vert->tip_set = tip;
+    sector_t *sec = lev_sectors[i];
+    int num = start[i+1] - start[i];
+
+    if (num == 0 || num > CONVEX_MAX_LINES)
+      continue;
+
+    sec->is_convex = CheckConvexEdges(edges + start[i], num,
+        &sec->convex_min_len);
   }
+
+  UtilFree(edges);
+  UtilFree(start);
+  UtilFree(fill);
 }
 
-void CalculateWallTips(void)
+static INLINE_G int IsSectorBoundary(const linedef_t *L)
 {
-  int i;
+  if (! L->right || ! L->right->sector)
+    return FALSE;
+
+  return (! L->left || L->left->sector != L->right->sector);
+}
+
+//
+// DetectBoundaryRuns
+//
+// Groups the linedefs which separate two sectors (or a sector from
+// the void) by their line equation, like DetectOverlappingLines.
+// Every group of two or more is a "run", and those lines are good
+// places for the first partitions of -strategy boundary, since the
+// segs along them never need splitting.
+//
+void DetectBoundaryRuns(void)
+{
+  int i, total = 0;
+  int count = 0;
+
+  overlap_key_t *keys = UtilCalloc(MAX(1, num_linedefs) *
+      sizeof(overlap_key_t));
 
   DisplayTicker();
 
   for (i=0; i < num_linedefs; i++)
   {
-    linedef_t *line = lev_linedefs[i];
+    linedef_t *L = lev_linedefs[i];
+
+    L->run = NULL;
+    L->run_len = 0;
+    L->run_stamp = 0;
 
-    if (line->self_ref && cur_info->skip_self_ref)
+    if (L->zero_len || L->overlap || ! IsSectorBoundary(L))
       continue;
 
-    float_g x1 = line->start->x;
-    float_g y1 = line->start->y;
-    float_g x2 = line->end->x;
-    float_g y2 = line->end->y;
+    if (MakeOverlapKey(&keys[total], L))
+      total++;
+  }
 
-    sector_t *left  = (line->left)  ? line->left->sector  : NULL;
-    sector_t *right = (line->right) ? line->right->sector : NULL;
-    
-    VertexAddWallTip(line->start, x2-x1, y2-y1, left, right);
-    VertexAddWallTip(line->end,   x1-x2, y1-y2, right, left);
+  qsort(keys, total, sizeof(overlap_key_t), OverlapCompare);
+
+  for (i=0; i < total; )
+  {
+    int k = i + 1;
+
+    while (k < total && SameLine(&keys[k], &keys[i]))
+      k++;
+
+    if (k - i >= 2)
+    {
+      linedef_t *first = lev_linedefs[keys[i].index];
+
+      for (; i < k; i++)
+        lev_linedefs[keys[i].index]->run = first;
+
+      count++;
+    }
+
+    i = k;
+  }
+
+  PrintVerbose("Found %d runs of collinear sector boundaries\n", count);
+
+  UtilFree(keys);
+}
+
+
+/* ----- vertex routines ------------------------------- */
+
+//
+// VertexAddWallTip
+//
+// The tips of a vertex are kept in an array in order of increasing
+// angle, and the caller must have made room for the new one.  A tip
+// goes after any existing tip whose angle is (nearly) the same.
+//
+static void VertexAddWallTip(vertex_t *vert, float_g dx, float_g dy,
+  sector_t *left, sector_t *right)
+{
+  angle_g angle = UtilComputeAngle(dx, dy);
+
+  int pos = vert->num_tips;
+
+  // find the correct place (order is increasing angle)
+  while (pos > 0 && angle + ANG_EPSILON < vert->tip_set[pos-1].angle)
+  {
+    vert->tip_set[pos] = vert->tip_set[pos-1];
+    pos--;
+  }
+
+  if (pos > 0 && vert->tip_set[pos-1].angle > angle)
+    vert->tips_unsorted = TRUE;
+
+  vert->tip_set[pos].angle = angle;
+  vert->tip_set[pos].left  = left;
+  vert->tip_set[pos].right = right;
+
+  vert->num_tips++;
+}
+
+//
+// LinePartVertex
+//
+// When only part of a linedef gets segs (see DetectOverlappingLines),
+// that part begins or ends at a vertex in the middle of the linedef,
+// which needs a wall tip too.  Returns that vertex, or NULL.  The
+// 'at_start' parameter is set when it is where the part begins.
+//
+static vertex_t *LinePartVertex(const linedef_t *line, int *at_start)
+{
+  *at_start = (line->part_start && line->part_start != line->start);
+
+  if (*at_start)
+    return line->part_start;
+
+  if (line->part_end && line->part_end != line->end)
+    return line->part_end;
+
+  return NULL;
+}
+
+void CalculateWallTips(void)
+{
+  int i, pass;
+  int total = 0;
+  wall_tip_t *tips = NULL;
+
+  DisplayTicker();
+
+  // the first pass counts the tips of each vertex, so that they can
+  // all go into one array, and the second pass adds them.
+
+  for (pass=0; pass < 2; pass++)
+  {
+    if (pass == 1)
+    {
+      for (i=0; i < num_vertices; i++)
+        total += lev_vertices[i]->num_tips;
+
+      tips = NewWallTips(MAX(1, total));
+
+      for (i=0, total=0; i < num_vertices; i++)
+      {
+        vertex_t *vert = lev_vertices[i];
+
+        vert->tip_set = tips + total;
+        total += vert->num_tips;
+
+        vert->num_tips = 0;
+        vert->tips_unsorted = FALSE;
+      }
+    }
+
+    for (i=0; i < num_linedefs; i++)
+    {
+      linedef_t *line = lev_linedefs[i];
+      vertex_t *mid;
+      int at_start;
+
+      if (line->self_ref && cur_info->skip_self_ref)
+        continue;
+
+      mid = LinePartVertex(line, &at_start);
+
+      if (pass == 0)
+      {
+        line->start->num_tips++;
+        line->end->num_tips++;
+
+        if (mid)
+          mid->num_tips++;
+
+        continue;
+      }
+
+      {
+        float_g x1 = line->start->x;
+        float_g y1 = line->start->y;
+        float_g x2 = line->end->x;
+        float_g y2 = line->end->y;
+
+        sector_t *left  = (line->left)  ? line->left->sector  : NULL;
+        sector_t *right = (line->right) ? line->right->sector : NULL;
+
+        VertexAddWallTip(line->start, x2-x1, y2-y1, left, right);
+        VertexAddWallTip(line->end,   x1-x2, y1-y2, right, left);
+
+        if (mid && at_start)
+          VertexAddWallTip(mid, x2 - mid->x, y2 - mid->y, left, right);
+        else if (mid)
+          VertexAddWallTip(mid, x1 - mid->x, y1 - mid->y, right, left);
+      }
+    }
   }
  
 # if DEBUG_WALLTIPS
   for (i=0; i < num_vertices; i++)
   {
     vertex_t *vert = LookupVertex(i);
-    wall_tip_t *tip;
+    int k;
 
     PrintDebug("WallTips for vertex %d:\n", i);
 
-    for (tip=vert->tip_set; tip; tip=tip->next)
+    for (k=0; k < vert->num_tips; k++)
     {
+      wall_tip_t *tip = &vert->tip_set[k];
+
       PrintDebug("  Angle=%1.1f left=%d right=%d\n", tip->angle,
         tip->left ? tip->left->index : -1,
         tip->right ? tip->right->index : -1);
@@ -986,12 +1688,170 @@ void CalculateWallTips(void)
 # endif
 }
 
+/* ----- split vertex table ------------------------------- */
+
+// Different partitions often split segs at the same place, for
+// example where two linedefs cross or overlap.  The vertices made by
+// splitting segs are kept in a hash table of one unit square cells,
+// so that a later split within SNAP_EPSILON of one of them can reuse
+// it instead of making another vertex.
+
+#define SNAP_EPSILON  (1.0 / 1024.0)
+
+static vertex_t **snap_heads = NULL;
+static int snap_size;
+static int snap_entries;
+
+static int snap_count;
+
+//
+// CreateSplitTable
+//
+void CreateSplitTable(void)
+{
+  for (snap_size = 1024; snap_size < num_linedefs * 2; snap_size *= 2)
+  { }
+
+  snap_heads = UtilCalloc(snap_size * sizeof(vertex_t *));
+  snap_entries = 0;
+  snap_count = 0;
+}
+
+//
+// FreeSplitTable
+//
+void FreeSplitTable(void)
+{
+  if (snap_count > 0)
+    PrintVerbose("Reused %d split vertices\n", snap_count);
+
+  if (snap_heads)
+    UtilFree(snap_heads);
+
+  snap_heads = NULL;
+}
+
+static INLINE_G int SnapCell(float_g v)
+{
+  return (int) floor(v);
+}
+
+static INLINE_G int SnapHash(int cx, int cy)
+{
+  unsigned int hash = 2166136261U;
+
+  hash = DupHashInt(hash, cx);
+  hash = DupHashInt(hash, cy);
+
+  return (int)(hash & (snap_size - 1));
+}
+
+//
+// FindSplitVertex
+//
+// Looks for an earlier split vertex within SNAP_EPSILON of (x,y) which
+// also lies on the seg's line.  Returns NULL if there is none.
+//
+static vertex_t *FindSplitVertex(seg_t *seg, float_g x, float_g y)
+{
+  int cx, cy;
+
+  for (cx = SnapCell(x - SNAP_EPSILON); cx <= SnapCell(x + SNAP_EPSILON); cx++)
+  for (cy = SnapCell(y - SNAP_EPSILON); cy <= SnapCell(y + SNAP_EPSILON); cy++)
+  {
+    vertex_t *V;
+
+    for (V = snap_heads[SnapHash(cx, cy)]; V; V = V->snap_next)
+    {
+      if (fabs(V->x - x) > SNAP_EPSILON || fabs(V->y - y) > SNAP_EPSILON)
+        continue;
+
+      // never make a zero length seg
+      if (V == seg->start || V == seg->end)
+        continue;
+
+      if (fabs(UtilPerpDist(seg, V->x, V->y)) > SNAP_EPSILON)
+        continue;
+
+      return V;
+    }
+  }
+
+  return NULL;
+}
+
+static void AddSplitVertex(vertex_t *vert)
+{
+  int pos;
+
+  // keep the chains short by doubling the table when it gets full
+  if (snap_entries >= snap_size)
+  {
+    vertex_t **old_heads = snap_heads;
+    int old_size = snap_size;
+
+    snap_size *= 2;
+    snap_heads = UtilCalloc(snap_size * sizeof(vertex_t *));
+
+    for (pos=0; pos < old_size; pos++)
+    {
+      while (old_heads[pos])
+      {
+        vertex_t *V = old_heads[pos];
+        int new_pos = SnapHash(SnapCell(V->x), SnapCell(V->y));
+
+        old_heads[pos] = V->snap_next;
+
+        V->snap_next = snap_heads[new_pos];
+        snap_heads[new_pos] = V;
+      }
+    }
+
+    UtilFree(old_heads);
+  }
+
+  pos = SnapHash(SnapCell(vert->x), SnapCell(vert->y));
+
+  vert->snap_next = snap_heads[pos];
+  snap_heads[pos] = vert;
+
+  snap_entries++;
+}
+
 //
 // NewVertexFromSplitSeg
 //
+// When an earlier split vertex is reused, the wall tips of the seg
+// are merged into it.
+//
 vertex_t *NewVertexFromSplitSeg(seg_t *seg, float_g x, float_g y)
 {
-  vertex_t *vert = NewVertex();
+  vertex_t *vert = snap_heads ? FindSplitVertex(seg, x, y) : NULL;
+
+  if (vert)
+  {
+    wall_tip_t *old_tips = vert->tip_set;
+
+    vert->tip_set = NewWallTips(vert->num_tips + 2);
+    memcpy(vert->tip_set, old_tips, vert->num_tips * sizeof(wall_tip_t));
+
+    VertexAddWallTip(vert, -seg->pdx, -seg->pdy, seg->sector, 
+        seg->partner ? seg->partner->sector : NULL);
+
+    VertexAddWallTip(vert, seg->pdx, seg->pdy,
+        seg->partner ? seg->partner->sector : NULL, seg->sector);
+
+    vert->ref_count += seg->partner ? 4 : 2;
+
+    if (vert->normal_dup)
+      vert->normal_dup->ref_count = vert->ref_count;
+
+    snap_count++;
+
+    return vert;
+  }
+
+  vert = NewVertex();
 
   vert->x = x;
   vert->y = y;
@@ -1011,6 +1871,8 @@ vertex_t *NewVertexFromSplitSeg(seg_t *seg, float_g x, float_g y)
 
   // compute wall_tip info
 
+  vert->tip_set = NewWallTips(2);
+
   VertexAddWallTip(vert, -seg->pdx, -seg->pdy, seg->sector, 
       seg->partner ? seg->partner->sector : NULL);
 
@@ -1031,6 +1893,9 @@ vertex_t *NewVertexFromSplitSeg(seg_t *seg, float_g x, float_g y)
     num_normal_vert++;
   }
 
+  if (snap_heads)
+    AddSplitVertex(vert);
+
   return vert;
 }
 
@@ -1080,51 +1945,92 @@ vertex_t *NewVertexDegenerate(vertex_t *start, vertex_t *end)
   return vert;
 }
 
+//
+// VertexCheckOpenSlow
+//
+// Like VertexCheckOpen, but looks at every tip, for when the tips are
+// not strictly sorted.
+//
+static sector_t * VertexCheckOpenSlow(vertex_t *vert, angle_g angle)
+{
+  const wall_tip_t *tips = vert->tip_set;
+  int num = vert->num_tips;
+  int k;
+
+  for (k=0; k < num; k++)
+  {
+    if (fabs(tips[k].angle - angle) < ANG_EPSILON ||
+        fabs(tips[k].angle - angle) > (360.0 - ANG_EPSILON))
+    {
+      return NULL;
+    }
+  }
+
+  for (k=0; k < num; k++)
+  {
+    if (angle + ANG_EPSILON < tips[k].angle)
+      return tips[k].right;
+  }
+
+  return tips[num-1].left;
+}
+
 //
 // VertexCheckOpen
 //
 sector_t * VertexCheckOpen(vertex_t *vert, float_g dx, float_g dy)
 {
-  wall_tip_t *tip;
+  const wall_tip_t *tips = vert->tip_set;
+  int num = vert->num_tips;
+  int lo, hi, k;
 
   angle_g angle = UtilComputeAngle(dx, dy);
 
-  // first check whether there's a wall_tip that lies in the exact
+  if (num == 0)
+    InternalError("Vertex %d has no tips !", vert->index);
+
+  if (vert->tips_unsorted)
+    return VertexCheckOpenSlow(vert, angle);
+
+  // find the first wall_tip whose angle is greater than the angle
+  // we're interested in (binary search, the tips are sorted).  Each
+  // tip goes after any tip within ANG_EPSILON, so this only works
+  // when none of them has a smaller angle than the one before.
+
+  for (lo=0, hi=num; lo < hi; )
+  {
+    int mid = (lo + hi) / 2;
+
+    if (angle + ANG_EPSILON < tips[mid].angle)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  // check whether there's a wall_tip that lies in the exact
   // direction of the given direction (which is relative to the
-  // vertex).
+  // vertex).  Only the tips just before the one found can be that
+  // close, apart from the ones at each end (wrapping around 360).
 
-  for (tip=vert->tip_set; tip; tip=tip->next)
+  for (k=lo-1; k >= 0 && tips[k].angle > angle - ANG_EPSILON; k--)
   {
-    if (fabs(tip->angle - angle) < ANG_EPSILON ||
-        fabs(tip->angle - angle) > (360.0 - ANG_EPSILON))
-    {
-      // yes, found one
+    if (fabs(tips[k].angle - angle) < ANG_EPSILON)
       return NULL;
-    }
   }
 
-  // OK, now just find the first wall_tip whose angle is greater than
-  // the angle we're interested in.  Therefore we'll be on the RIGHT
-  // side of that wall_tip.
-
-  for (tip=vert->tip_set; tip; tip=tip->next)
+  if (fabs(tips[0].angle - angle) > (360.0 - ANG_EPSILON) ||
+      fabs(tips[num-1].angle - angle) > (360.0 - ANG_EPSILON))
   {
-    if (angle + ANG_EPSILON < tip->angle)
-    {
-      // found it
-      return tip->right;
-    }
+    return NULL;
+  }
 
-    if (! tip->next)
-    {
-      // no more tips, thus we must be on the LEFT side of the tip
-      // with the largest angle.
+  // we'll be on the RIGHT side of the tip found.  When there was
+  // none, we must be on the LEFT side of the tip with the largest
+  // angle.
 
-      return tip->left;
-    }
-  }
- 
-  InternalError("Vertex %d has no tips !", vert->index);
-  return FALSE;
+  if (lo < num)
+    return tips[lo].right;
+
+  return tips[num-1].left;
 }
 
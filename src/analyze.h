@@ -24,22 +24,30 @@
 #include "structs.h"
 #include "level.h"
 
+// grid of linedefs used by the polyobj and window effect detection
+void CreateLineIndex(void);
+void FreeLineIndex(void);
+
 // detection routines
 void DetectDuplicateVertices(void);
 void DetectDuplicateSidedefs(void);
 void DetectPolyobjSectors(void);
 void DetectOverlappingLines(void);
 void DetectWindowEffects(void);
+void DetectConvexSectors(void);
+void DetectBoundaryRuns(void);
 
-// pruning routines
-void PruneLinedefs(void);
-void PruneVertices(void);
-void PruneSidedefs(void);
-void PruneSectors(void);
+// removes zero length linedefs, duplicates and unused stuff
+void PruneLevel(void);
 
 // computes the wall tips for all of the vertices
 void CalculateWallTips(void);
 
+// table of split vertices, allowing splits at the same place to
+// share a vertex
+void CreateSplitTable(void);
+void FreeSplitTable(void);
+
 // return a new vertex (with correct wall_tip info) for the split that
 // happens along the given seg at the given location.
 //
@@ -48,7 +48,15 @@ static int block_count;
 static int block_mid_x = 0;
 static int block_mid_y = 0;
 
-static uint16_g ** block_lines;
+// the line lists of all blocks, stored one after the other (like a
+// CSR sparse matrix).  The lines of block N are found in block_lines
+// from block_start[N] up to block_start[N+1].
+static int *block_start;
+static uint16_g *block_lines;
+
+// per-block counters used while building the above
+static int *block_fill;
+static boolean_g block_counting;
 
 static uint16_g *block_ptrs;
 static uint16_g *block_dups;
@@ -56,6 +64,13 @@ static uint16_g *block_dups;
 static int block_compression;
 static int block_overflowed;
 
+// how the lump is being packed, see below
+static int block_mode;
+
+#define BMODE_TAILS    0x0001  /* share tails of line lists       */
+#define BMODE_ORDER    0x0002  /* reorder lines to share more     */
+#define BMODE_NOZERO   0x0004  /* no leading zero in line lists   */
+
 #define DUMMY_DUP  0xFFFF
 
 
@@ -144,62 +159,105 @@ int CheckLinedefInsideBox(int xmin, int ymin, int xmax, int ymax,
 
 /* ----- create blockmap ------------------------------------ */
 
-#define BK_NUM    0
-#define BK_MAX    1
-#define BK_XOR    2
-#define BK_FIRST  3
-
-#define BK_QUANTUM  32
+#define BLOCK_LEN(blk)   (block_start[(blk)+1] - block_start[blk])
 
 static void BlockAdd(int blk_num, int line_index)
 {
-  uint16_g *cur = block_lines[blk_num];
-
 # if DEBUG_BLOCKMAP
   PrintDebug("Block %d has line %d\n", blk_num, line_index);
 # endif
 
   if (blk_num < 0 || blk_num >= block_count)
     InternalError("BlockAdd: bad block number %d", blk_num);
-    
-  if (! cur)
+
+  // first pass only counts the lines in each block
+  if (block_counting)
   {
-    // create empty block
-    block_lines[blk_num] = cur = UtilCalloc(BK_QUANTUM * 
-        sizeof(uint16_g));
-    cur[BK_NUM] = 0;
-    cur[BK_MAX] = BK_QUANTUM;
-    cur[BK_XOR] = 0x1234;
+    block_fill[blk_num]++;
+    return;
   }
 
-  if (BK_FIRST + cur[BK_NUM] == cur[BK_MAX])
-  {
-    // no more room, so allocate some more...
-    cur[BK_MAX] += BK_QUANTUM;
+  block_lines[block_fill[blk_num]++] = UINT16(line_index);
+}
 
-    block_lines[blk_num] = cur = UtilRealloc(cur, cur[BK_MAX] * 
-        sizeof(uint16_g));
-  }
+//
+// BlockRowSpan
+//
+// For a diagonal line, computes which blocks in row 'by' need to be
+// tested with CheckLinedefInsideBox(), namely the ones the line
+// crosses within that row plus one extra block on each side.
+//
+// The box test is edge inclusive and rounds its clipped points
+// toward zero, so it can accept blocks which the line misses by
+// less than a unit.  For nearly horizontal lines that can be a long
+// way along the row, hence the row is widened by BLOCK_SPAN_PAD
+// units before finding where the line crosses it.
+//
+#define BLOCK_SPAN_PAD  2
+
+static void BlockRowSpan(int by, int x1, int y1, int x2, int y2,
+    int bx1, int bx2, int *lo, int *hi)
+{
+  double ya = block_y + by * 128 - BLOCK_SPAN_PAD;
+  double yb = block_y + by * 128 + 127 + BLOCK_SPAN_PAD;
+
+  double xa, xb;
+
+  if (ya < MIN(y1, y2)) ya = MIN(y1, y2);
+  if (yb > MAX(y1, y2)) yb = MAX(y1, y2);
+
+  xa = x1 + (x2 - x1) * (ya - y1) / (double)(y2 - y1);
+  xb = x1 + (x2 - x1) * (yb - y1) / (double)(y2 - y1);
 
-  // compute new checksum
-  cur[BK_XOR] = ((cur[BK_XOR] << 4) | (cur[BK_XOR] >> 12)) ^ line_index;
+  *lo = (int) floor((MIN(xa, xb) - block_x) / 128.0) - 1;
+  *hi = (int) floor((MAX(xa, xb) - block_x) / 128.0) + 1;
 
-  cur[BK_FIRST + cur[BK_NUM]] = UINT16(line_index);
-  cur[BK_NUM]++;
+  if (*lo < bx1) *lo = bx1;
+  if (*hi > bx2) *hi = bx2;
 }
 
-static void BlockAddLine(linedef_t *L)
+//
+// BlockLineRange
+//
+// Computes the range of blocks covered by the line's bounding box.
+// Returns FALSE if it lies outside the (truncated) blockmap.
+//
+static int BlockLineRange(linedef_t *L, int *bx1, int *by1,
+    int *bx2, int *by2)
 {
   int x1 = (int) L->start->x;
   int y1 = (int) L->start->y;
   int x2 = (int) L->end->x;
   int y2 = (int) L->end->y;
 
-  int bx1 = (MIN(x1,x2) - block_x) / 128;
-  int by1 = (MIN(y1,y2) - block_y) / 128;
-  int bx2 = (MAX(x1,x2) - block_x) / 128;
-  int by2 = (MAX(y1,y2) - block_y) / 128;
+  *bx1 = (MIN(x1,x2) - block_x) / 128;
+  *by1 = (MIN(y1,y2) - block_y) / 128;
+  *bx2 = (MAX(x1,x2) - block_x) / 128;
+  *by2 = (MAX(y1,y2) - block_y) / 128;
+
+  // handle truncated blockmaps
+  if (*bx1 < 0) *bx1 = 0;
+  if (*by1 < 0) *by1 = 0;
+  if (*bx2 >= block_w) *bx2 = block_w - 1;
+  if (*by2 >= block_h) *by2 = block_h - 1;
+
+  return (*bx2 >= *bx1 && *by2 >= *by1);
+}
 
+//
+// BlockAddLine
+//
+// Adds the line to every block it touches in rows 'row_lo' to
+// 'row_hi' (so that bands of rows can be done separately).
+//
+static void BlockAddLine(linedef_t *L, int row_lo, int row_hi)
+{
+  int x1 = (int) L->start->x;
+  int y1 = (int) L->start->y;
+  int x2 = (int) L->end->x;
+  int y2 = (int) L->end->y;
+
+  int bx1, by1, bx2, by2;
   int bx, by;
   int line_index = L->index;
 
@@ -208,18 +266,15 @@ static void BlockAddLine(linedef_t *L)
       x1, y1, x2, y2);
 # endif
 
-  // handle truncated blockmaps
-  if (bx1 < 0) bx1 = 0;
-  if (by1 < 0) by1 = 0;
-  if (bx2 >= block_w) bx2 = block_w - 1;
-  if (by2 >= block_h) by2 = block_h - 1;
-
-  if (bx2 < bx1 || by2 < by1)
+  if (! BlockLineRange(L, &bx1, &by1, &bx2, &by2))
     return;
 
   // handle simple case #1: completely horizontal
   if (by1 == by2)
   {
+    if (by1 < row_lo || by1 > row_hi)
+      return;
+
     for (bx=bx1; bx <= bx2; bx++)
     {
       int blk_num = by1 * block_w + bx;
@@ -228,6 +283,11 @@ static void BlockAddLine(linedef_t *L)
     return;
   }
 
+  // the cases below depend on the whole line, so only now limit
+  // it to the band.
+  by1 = MAX(by1, row_lo);
+  by2 = MIN(by2, row_hi);
+
   // handle simple case #2: completely vertical
   if (bx1 == bx2)
   {
@@ -239,161 +299,541 @@ static void BlockAddLine(linedef_t *L)
     return;
   }
 
-  // handle the rest (diagonals)
+  // handle the rest (diagonals).  Only the blocks near the line in
+  // each row are tested, instead of the whole bounding box.
 
   for (by=by1; by <= by2; by++)
-  for (bx=bx1; bx <= bx2; bx++)
   {
-    int blk_num = by * block_w + bx;
-  
-    int minx = block_x + bx * 128;
-    int miny = block_y + by * 128;
-    int maxx = minx + 127;
-    int maxy = miny + 127;
+    int lo, hi;
+
+    BlockRowSpan(by, x1, y1, x2, y2, bx1, bx2, &lo, &hi);
 
-    if (CheckLinedefInsideBox(minx, miny, maxx, maxy, x1, y1, x2, y2))
+    for (bx=lo; bx <= hi; bx++)
     {
-      BlockAdd(blk_num, line_index);
+      int blk_num = by * block_w + bx;
+    
+      int minx = block_x + bx * 128;
+      int miny = block_y + by * 128;
+      int maxx = minx + 127;
+      int maxy = miny + 127;
+
+      if (CheckLinedefInsideBox(minx, miny, maxx, maxy, x1, y1, x2, y2))
+      {
+        BlockAdd(blk_num, line_index);
+      }
     }
   }
 }
 
-static void CreateBlockmap(void)
+/* ----- bands ----------------------------------------------------- */
+
+// When threads are available, the rows of blocks are split into a
+// few bands, and the lines of each band are added on a thread of
+// its own.  Each band only touches its own blocks, and lines are
+// still added in order, so the result is the same.
+
+#define BAND_MIN_ROWS   8
+#define BAND_MIN_LINES  500
+
+typedef struct block_band_s
 {
-  int i;
+  // rows of blocks in this band
+  int row_lo, row_hi;
 
-  block_lines = UtilCalloc(block_count * sizeof(uint16_g *));
+  // lines which may touch this band (NULL means all of them)
+  int *lines;
+  int num_lines;
+}
+block_band_t;
 
-  DisplayTicker();
+static block_band_t *block_bands;
+static int block_num_bands;
 
-  for (i=0; i < num_linedefs; i++)
+
+static void BlockBandWorker(void *data)
+{
+  block_band_t *band = (block_band_t *) data;
+  int i;
+
+  for (i=0; i < band->num_lines; i++)
   {
-    linedef_t *L = LookupLinedef(i);
+    linedef_t *L = LookupLinedef(band->lines ? band->lines[i] : i);
 
     // ignore zero-length lines
     if (L->zero_len)
       continue;
 
-    BlockAddLine(L);
+    BlockAddLine(L, band->row_lo, band->row_hi);
   }
 }
 
+//
+// BlockCreateBands
+//
+// Decides how many bands to use, and puts each line into the bands
+// which its bounding box overlaps.
+//
+static void BlockCreateBands(void)
+{
+  int i, b;
+  int bx1, by1, bx2, by2;
+  int *band_fill;
+
+  block_num_bands = MIN(ThreadCount(), block_h / BAND_MIN_ROWS);
+
+  if (num_linedefs < BAND_MIN_LINES)
+    block_num_bands = 1;
+
+  block_num_bands = MAX(1, block_num_bands);
+
+  block_bands = UtilCalloc(block_num_bands * sizeof(block_band_t));
+
+  for (b=0; b < block_num_bands; b++)
+  {
+    block_bands[b].row_lo = block_h *  b    / block_num_bands;
+    block_bands[b].row_hi = block_h * (b+1) / block_num_bands - 1;
+  }
 
-static int BlockCompare(const void *p1, const void *p2)
+  if (block_num_bands == 1)
+  {
+    block_bands[0].num_lines = num_linedefs;
+    return;
+  }
+
+  // bucket the lines, counting them first
+
+  band_fill = UtilCalloc(block_num_bands * sizeof(int));
+
+  for (i=0; i < num_linedefs; i++)
+  {
+    if (! BlockLineRange(LookupLinedef(i), &bx1, &by1, &bx2, &by2))
+      continue;
+
+    for (b=0; b < block_num_bands; b++)
+      if (by1 <= block_bands[b].row_hi && by2 >= block_bands[b].row_lo)
+        band_fill[b]++;
+  }
+
+  for (b=0; b < block_num_bands; b++)
+  {
+    block_bands[b].lines = UtilCalloc(MAX(1, band_fill[b]) * sizeof(int));
+    block_bands[b].num_lines = 0;
+  }
+
+  for (i=0; i < num_linedefs; i++)
+  {
+    if (! BlockLineRange(LookupLinedef(i), &bx1, &by1, &bx2, &by2))
+      continue;
+
+    for (b=0; b < block_num_bands; b++)
+    {
+      block_band_t *band = block_bands + b;
+
+      if (by1 <= band->row_hi && by2 >= band->row_lo)
+        band->lines[band->num_lines++] = i;
+    }
+  }
+
+  UtilFree(band_fill);
+}
+
+static void BlockFreeBands(void)
 {
-  int blk_num1 = ((const uint16_g *) p1)[0];
-  int blk_num2 = ((const uint16_g *) p2)[0];
+  int b;
 
-  const uint16_g *A = block_lines[blk_num1];
-  const uint16_g *B = block_lines[blk_num2];
+  for (b=0; b < block_num_bands; b++)
+    if (block_bands[b].lines)
+      UtilFree(block_bands[b].lines);
 
-  if (A == B)
-    return 0;
+  UtilFree(block_bands);
+  block_bands = NULL;
+}
 
-  if (A == NULL) return -1;
-  if (B == NULL) return +1;
+//
+// BlockAddAllLines
+//
+// Runs one pass over the lines, doing the bands in parallel.  The
+// first band is done on this thread.
+//
+static void BlockAddAllLines(void)
+{
+  thread_t **threads;
+  int b;
 
-  if (A[BK_NUM] != B[BK_NUM])
+  if (block_num_bands == 1)
   {
-    return A[BK_NUM] - B[BK_NUM];
+    BlockBandWorker(block_bands);
+    return;
   }
- 
-  if (A[BK_XOR] != B[BK_XOR])
+
+  threads = UtilCalloc(block_num_bands * sizeof(thread_t *));
+
+  for (b=1; b < block_num_bands; b++)
+    threads[b] = ThreadStart(BlockBandWorker, block_bands + b);
+
+  BlockBandWorker(block_bands);
+
+  for (b=1; b < block_num_bands; b++)
+    ThreadJoin(threads[b]);
+
+  UtilFree(threads);
+}
+
+//
+// CreateBlockmap
+//
+// Done in two passes: the first counts the lines in each block, and
+// the second stores them into a single array, using the offsets
+// computed from those counts.
+//
+static void CreateBlockmap(void)
+{
+  int i;
+
+  block_start = UtilCalloc((block_count + 1) * sizeof(int));
+  block_fill  = UtilCalloc(block_count * sizeof(int));
+
+  DisplayTicker();
+
+  BlockCreateBands();
+
+  block_counting = TRUE;
+
+  BlockAddAllLines();
+
+  for (i=0; i < block_count; i++)
   {
-    return A[BK_XOR] - B[BK_XOR];
+    block_start[i+1] = block_start[i] + block_fill[i];
+
+    block_fill[i] = block_start[i];
   }
- 
-  return memcmp(A+BK_FIRST, B+BK_FIRST, A[BK_NUM] * sizeof(uint16_g));
+
+  block_lines = UtilCalloc(MAX(1, block_start[block_count]) *
+      sizeof(uint16_g));
+
+  block_counting = FALSE;
+
+  BlockAddAllLines();
+
+  BlockFreeBands();
+
+  UtilFree(block_fill);
+  block_fill = NULL;
 }
 
-static void CompressBlockmap(void)
+
+/* ----- compress blockmap ---------------------------------- */
+
+// Identical line lists are found with a hash table keyed on the
+// list contents.  When tail sharing is enabled (-blocktail), a list
+// which matches the end of a longer one is also found, and the
+// longer list is reused for it.  A hash table entry is a block
+// number plus the position in its list where the (sub)list starts.
+
+typedef struct block_hash_s
+{
+  int blk_num;  // -1 for an empty slot
+  int pos;
+  int len;
+  unsigned int hash;
+}
+block_hash_t;
+
+static block_hash_t *block_hashes;
+static int block_hash_size;
+
+// for each block, the block whose line list it uses (itself when the
+// list is written out), and where in that list its own list begins.
+static int *block_host;
+static int *block_host_pos;
+
+
+static unsigned int BlockHashList(const uint16_g *list, int len)
+{
+  unsigned int hash = 2166136261U;
+
+  // hashed from the end, so that BlockHashTails can share the work
+  for (len--; len >= 0; len--)
+    hash = (hash ^ list[len]) * 16777619U;
+
+  return hash;
+}
+
+static void BlockHashInit(int max_entries)
 {
   int i;
+
+  for (block_hash_size = 64; block_hash_size < max_entries * 2;
+       block_hash_size *= 2)
+  { }
+
+  block_hashes = UtilCalloc(block_hash_size * sizeof(block_hash_t));
+
+  for (i=0; i < block_hash_size; i++)
+    block_hashes[i].blk_num = -1;
+}
+
+//
+// BlockHashFind
+//
+// Looks for the given list (the lines of 'blk_num' from 'pos'
+// onwards).  Returns the matching entry, or the empty slot where it
+// should be added.
+//
+static block_hash_t *BlockHashFind(int blk_num, int pos, unsigned int hash)
+{
+  const uint16_g *list = block_lines + block_start[blk_num] + pos;
+  int len = BLOCK_LEN(blk_num) - pos;
+
+  int i = (int)(hash & (block_hash_size - 1));
+
+  for (;;)
+  {
+    block_hash_t *H = block_hashes + i;
+
+    if (H->blk_num < 0)
+      return H;
+
+    if (H->hash == hash && H->len == len &&
+        memcmp(block_lines + block_start[H->blk_num] + H->pos, list,
+          len * sizeof(uint16_g)) == 0)
+    {
+      return H;
+    }
+
+    i = (i + 1) & (block_hash_size - 1);
+  }
+}
+
+static void BlockHashAdd(block_hash_t *H, int blk_num, int pos,
+    unsigned int hash)
+{
+  H->blk_num = blk_num;
+  H->pos  = pos;
+  H->len  = BLOCK_LEN(blk_num) - pos;
+  H->hash = hash;
+}
+
+//
+// BlockHashTails
+//
+// Adds every proper tail of the block's list to the hash table.
+// When a tail is the same as another block's whole list, that block
+// can use this one instead.
+//
+static void BlockHashTails(int blk_num)
+{
+  const uint16_g *list = block_lines + block_start[blk_num];
+  int len = BLOCK_LEN(blk_num);
+
+  unsigned int hash = 2166136261U;
+  int pos;
+
+  for (pos=len-1; pos >= 1; pos--)
+  {
+    block_hash_t *H;
+
+    hash = (hash ^ list[pos]) * 16777619U;
+
+    H = BlockHashFind(blk_num, pos, hash);
+
+    if (H->blk_num < 0)
+    {
+      BlockHashAdd(H, blk_num, pos, hash);
+      continue;
+    }
+
+    if (H->pos == 0 && block_host[H->blk_num] == H->blk_num)
+    {
+      block_host[H->blk_num]     = blk_num;
+      block_host_pos[H->blk_num] = pos;
+    }
+  }
+}
+
+//
+// BlockFindShared
+//
+// Decides which blocks can reuse the line list of another block,
+// filling in block_host[] and block_host_pos[].  The first of a set
+// of identical lists is the one which gets written.  Tails are only
+// ever shared with longer lists, so there can be no loops.
+//
+static void BlockFindShared(void)
+{
+  int i;
+  int total = 0;
+
+  block_host     = UtilCalloc(block_count * sizeof(int));
+  block_host_pos = UtilCalloc(block_count * sizeof(int));
+
+  for (i=0; i < block_count; i++)
+    total += BLOCK_LEN(i);
+
+  BlockHashInit((block_mode & BMODE_TAILS) ? total : block_count);
+
+  for (i=0; i < block_count; i++)
+  {
+    block_hash_t *H;
+    unsigned int hash;
+
+    block_host[i] = i;
+
+    if (BLOCK_LEN(i) == 0)
+      continue;
+
+    hash = BlockHashList(block_lines + block_start[i], BLOCK_LEN(i));
+
+    H = BlockHashFind(i, 0, hash);
+
+    if (H->blk_num >= 0)
+      block_host[i] = H->blk_num;
+    else
+      BlockHashAdd(H, i, 0, hash);
+  }
+
+  if (block_mode & BMODE_TAILS)
+  {
+    for (i=0; i < block_count; i++)
+      if (BLOCK_LEN(i) > 1 && block_host[i] == i)
+        BlockHashTails(i);
+  }
+
+  UtilFree(block_hashes);
+  block_hashes = NULL;
+}
+
+//
+// BlockResolvePtr
+//
+static int BlockResolvePtr(int blk_num)
+{
+  int host = block_host[blk_num];
+
+  if (block_ptrs[blk_num] == 0)
+  {
+    block_ptrs[blk_num] = BlockResolvePtr(host) + block_host_pos[blk_num];
+  }
+
+  return block_ptrs[blk_num];
+}
+
+//
+// BlockOrderLines
+//
+// Sorts the lines in every block so that lines which are in many
+// blocks come last.  Neighbouring blocks then tend to have lists
+// ending the same way, which tail sharing can make use of.  The
+// engine does not care about the order.
+//
+static int *block_line_uses;
+
+static int LineUseCompare(const void *p1, const void *p2)
+{
+  int line1 = UINT16(((const uint16_g *) p1)[0]);
+  int line2 = UINT16(((const uint16_g *) p2)[0]);
+
+  if (block_line_uses[line1] != block_line_uses[line2])
+    return block_line_uses[line1] - block_line_uses[line2];
+
+  return line1 - line2;
+}
+
+static void BlockOrderLines(void)
+{
+  int i;
+
+  block_line_uses = UtilCalloc(MAX(1, num_linedefs) * sizeof(int));
+
+  for (i=0; i < block_start[block_count]; i++)
+    block_line_uses[UINT16(block_lines[i])]++;
+
+  for (i=0; i < block_count; i++)
+  {
+    qsort(block_lines + block_start[i], BLOCK_LEN(i), sizeof(uint16_g),
+        LineUseCompare);
+  }
+
+  UtilFree(block_line_uses);
+  block_line_uses = NULL;
+}
+
+//
+// BlockLayout
+//
+// Works out where every line list goes in the lump (for the current
+// block_mode), filling in block_ptrs[] and block_dups[].  Returns
+// the total size of the lump, in 16-bit words.
+//
+static int BlockLayout(void)
+{
+  int i;
+  int list_extra = (block_mode & BMODE_NOZERO) ? 1 : 2;
   int cur_offset;
   int dup_count=0;
 
   int orig_size, new_size;
 
-  block_ptrs = UtilCalloc(block_count * sizeof(uint16_g));
-  block_dups = UtilCalloc(block_count * sizeof(uint16_g));
-
   DisplayTicker();
 
-  // sort duplicate-detecting array.  After the sort, all duplicates
-  // will be next to each other.  The duplicate array gives the order
-  // of the blocklists in the BLOCKMAP lump.
-  
-  for (i=0; i < block_count; i++)
-    block_dups[i] = i;
-
-  qsort(block_dups, block_count, sizeof(uint16_g), BlockCompare);
+  BlockFindShared();
 
-  // scan duplicate array and build up offset array
+  // build up the offset array.  The duplicate array gives the order
+  // of the blocklists in the BLOCKMAP lump.
 
-  cur_offset = 4 + block_count + 2;
+  cur_offset = 4 + block_count + list_extra;
 
   orig_size = 4 + block_count;
   new_size  = cur_offset;
 
-  DisplayTicker();
-
   for (i=0; i < block_count; i++)
   {
-    int blk_num = block_dups[i];
-    int count;
+    int count = list_extra + BLOCK_LEN(i);
+
+    block_dups[i] = DUMMY_DUP;
+    block_ptrs[i] = 0;
 
     // empty block ?
-    if (block_lines[blk_num] == NULL)
+    if (BLOCK_LEN(i) == 0)
     {
-      block_ptrs[blk_num] = 4 + block_count;
-      block_dups[i] = DUMMY_DUP;
+      block_ptrs[i] = 4 + block_count;
 
-      orig_size += 2;
+      orig_size += list_extra;
       continue;
     }
 
-    count = 2 + block_lines[blk_num][BK_NUM];
-
-    // duplicate ?  Only the very last one of a sequence of duplicates
-    // will update the current offset value.
+    orig_size += count;
 
-    if (i+1 < block_count && 
-        BlockCompare(block_dups + i, block_dups + i+1) == 0)
+    // duplicate, or the tail of another block ?
+    if (block_host[i] != i)
     {
-      block_ptrs[blk_num] = cur_offset;
-      block_dups[i] = DUMMY_DUP;
-
-      // free the memory of the duplicated block
-      UtilFree(block_lines[blk_num]);
-      block_lines[blk_num] = NULL;
-      
       dup_count++;
-
-      orig_size += count;
       continue;
     }
 
-    // OK, this block is either the last of a series of duplicates, or
-    // just a singleton.
+    block_dups[i] = i;
 
-    block_ptrs[blk_num] = cur_offset;
+    if (cur_offset <= 65535)
+      block_ptrs[i] = cur_offset;
 
     cur_offset += count;
-
-    orig_size += count;
-    new_size  += count;
+    new_size   += count;
   }
 
-  if (cur_offset > 65535)
+  if (cur_offset <= 65535)
   {
-    MarkSoftFailure(LIMIT_BLOCKMAP);
-    block_overflowed = TRUE;
-    return;
+    // pointers of shared lists are the same in both modes: either
+    // just before the shared part, or right at it.
+    for (i=0; i < block_count; i++)
+      BlockResolvePtr(i);
   }
 
+  UtilFree(block_host);
+  UtilFree(block_host_pos);
+
 # if DEBUG_BLOCKMAP
-  PrintDebug("Blockmap: Last ptr = %d  duplicates = %d\n", 
-      cur_offset, dup_count);
+  PrintDebug("Blockmap: mode %d  Last ptr = %d  duplicates = %d\n", 
+      block_mode, cur_offset, dup_count);
 # endif
 
   block_compression = (orig_size - new_size) * 100 / orig_size;
@@ -401,6 +841,66 @@ static void CompressBlockmap(void)
   // there's a tiny chance of new_size > orig_size
   if (block_compression < 0)
     block_compression = 0;
+
+  return cur_offset;
+}
+
+//
+// CompressBlockmap
+//
+// When the blockmap is too big, some other ways of packing it are
+// tried in turn, and the first one that fits is used.  Dropping the
+// leading zeros is only done when the user allows it, since most
+// ports skip the first entry of every list.
+//
+static const int block_recovery[] =
+{
+  BMODE_TAILS,
+  BMODE_TAILS | BMODE_ORDER,
+  BMODE_TAILS | BMODE_ORDER | BMODE_NOZERO,
+  -1
+};
+
+static void CompressBlockmap(void)
+{
+  int i;
+  int first_mode;
+
+  block_ptrs = UtilCalloc(block_count * sizeof(uint16_g));
+  block_dups = UtilCalloc(block_count * sizeof(uint16_g));
+
+  first_mode = block_mode = cur_info->block_tails ? BMODE_TAILS : 0;
+
+  if (BlockLayout() <= 65535)
+    return;
+
+  for (i=0; block_recovery[i] >= 0; i++)
+  {
+    int mode = block_recovery[i];
+
+    if ((mode & first_mode) != first_mode || mode == first_mode)
+      continue;
+
+    if ((mode & BMODE_NOZERO) && ! cur_info->block_nozero)
+      continue;
+
+    if ((mode & BMODE_ORDER) && ! (block_mode & BMODE_ORDER))
+      BlockOrderLines();
+
+    block_mode = mode;
+
+    if (BlockLayout() <= 65535)
+    {
+      PrintMiniWarn("Blockmap too large, fitted using %s%s\n",
+          (block_mode & BMODE_ORDER)  ? "reordered tail sharing" :
+                                        "tail sharing",
+          (block_mode & BMODE_NOZERO) ? " without zeros" : "");
+      return;
+    }
+  }
+
+  MarkSoftFailure(LIMIT_BLOCKMAP);
+  block_overflowed = TRUE;
 }
 
 
@@ -414,6 +914,7 @@ static void WriteBlockmap(void)
 
   uint16_g null_block[2] = { 0x0000, 0xFFFF };
   uint16_g m_zero = 0x0000;
+  int null_start = (block_mode & BMODE_NOZERO) ? 1 : 0;
   uint16_g m_neg1 = 0xFFFF;
   
   // leave empty if the blockmap overflowed
@@ -440,25 +941,26 @@ static void WriteBlockmap(void)
   }
 
   // add the null block which _all_ empty blocks will use
-  AppendLevelLump(lump, null_block, sizeof(null_block));
+  AppendLevelLump(lump, null_block + null_start,
+      (2 - null_start) * sizeof(uint16_g));
 
   // handle each block list
   for (i=0; i < block_count; i++)
   {
     int blk_num = block_dups[i];
-    uint16_g *blk;
 
     // ignore duplicate or empty blocks
     if (blk_num == DUMMY_DUP)
       continue;
 
-    blk = block_lines[blk_num];
+    if (BLOCK_LEN(blk_num) == 0)
+      InternalError("WriteBlockmap: block %d is empty !", i);
 
-    if (blk == NULL)
-      InternalError("WriteBlockmap: block %d is NULL !", i);
+    if (! (block_mode & BMODE_NOZERO))
+      AppendLevelLump(lump, &m_zero, sizeof(uint16_g));
 
-    AppendLevelLump(lump, &m_zero, sizeof(uint16_g));
-    AppendLevelLump(lump, blk + BK_FIRST, blk[BK_NUM] * sizeof(uint16_g));
+    AppendLevelLump(lump, block_lines + block_start[blk_num],
+        BLOCK_LEN(blk_num) * sizeof(uint16_g));
     AppendLevelLump(lump, &m_neg1, sizeof(uint16_g));
   }
 }
@@ -466,14 +968,7 @@ static void WriteBlockmap(void)
 
 static void FreeBlockmap(void)
 {
-  int i;
-
-  for (i=0; i < block_count; i++)
-  {
-    if (block_lines[i])
-      UtilFree(block_lines[i]);
-  }
-
+  UtilFree(block_start);
   UtilFree(block_lines);
   UtilFree(block_ptrs);
   UtilFree(block_dups);
@@ -598,9 +1093,10 @@ void PutBlockmap(void)
   
   CreateBlockmap();
 
-  // -AJA- second phase: compress the blockmap.  We do this by sorting
-  //       the blocks, which is a typical way to detect duplicates in
-  //       a large list.
+  // -AJA- second phase: compress the blockmap.  Duplicate blocks
+  //       (and with -blocktail, shared list tails) are found with a
+  //       hash table (see BlockFindShared), and the lists are laid
+  //       out in block order.
 
   CompressBlockmap();
  
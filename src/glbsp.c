@@ -29,6 +29,7 @@
 #include <limits.h>
 #include <assert.h>
 
+#include "analyze.h"
 #include "blockmap.h"
 #include "level.h"
 #include "node.h"
@@ -70,9 +71,20 @@ const nodebuildinfo_t default_buildinfo =
   FALSE,   // merge_vert
   FALSE,   // skip_self_ref
   FALSE,   // window_fx
+  FALSE,   // block_tails
+  FALSE,   // block_nozero
 
   DEFAULT_BLOCK_LIMIT,   // block_limit
 
+  0,       // num_threads
+
+  DEFAULT_ZLIB_LEVEL,   // zlib_level
+
+  REJECT_FAST,   // reject_level
+  0,       // reject_dist
+
+  STRATEGY_NORMAL,   // build_strategy
+
   FALSE,   // missing_output
   FALSE    // same_filenames
 };
@@ -261,6 +273,102 @@ glbsp_ret_e GlbspParseArgs(nodebuildinfo_t *info,
       continue;
     }
 
+    if (UtilStrCaseCmp(opt_str, "threads") == 0 ||
+        UtilStrCaseCmp(opt_str, "j") == 0)
+    {
+      if (argc < 2)
+      {
+        SetErrorMsg("Missing threads value");
+        cur_comms = NULL;
+        return GLBSP_E_BadArgs;
+      }
+
+      info->num_threads = (int) strtol(argv[1], NULL, 10);
+
+      argv += 2; argc -= 2;
+      continue;
+    }
+
+    if (UtilStrCaseCmp(opt_str, "zlevel") == 0)
+    {
+      if (argc < 2)
+      {
+        SetErrorMsg("Missing zlevel value");
+        cur_comms = NULL;
+        return GLBSP_E_BadArgs;
+      }
+
+      info->zlib_level = (int) strtol(argv[1], NULL, 10);
+
+      argv += 2; argc -= 2;
+      continue;
+    }
+
+    if (UtilStrCaseCmp(opt_str, "reject") == 0)
+    {
+      if (argc < 2)
+      {
+        SetErrorMsg("Missing reject level");
+        cur_comms = NULL;
+        return GLBSP_E_BadArgs;
+      }
+
+      if (UtilStrCaseCmp(argv[1], "fast") == 0)
+        info->reject_level = REJECT_FAST;
+      else if (UtilStrCaseCmp(argv[1], "normal") == 0)
+        info->reject_level = REJECT_NORMAL;
+      else if (UtilStrCaseCmp(argv[1], "full") == 0)
+        info->reject_level = REJECT_FULL;
+      else
+      {
+        SetErrorMsg("Unknown reject level: %s", argv[1]);
+        cur_comms = NULL;
+        return GLBSP_E_BadArgs;
+      }
+
+      argv += 2; argc -= 2;
+      continue;
+    }
+
+    if (UtilStrCaseCmp(opt_str, "rejectdist") == 0)
+    {
+      if (argc < 2)
+      {
+        SetErrorMsg("Missing rejectdist value");
+        cur_comms = NULL;
+        return GLBSP_E_BadArgs;
+      }
+
+      info->reject_dist = (int) strtol(argv[1], NULL, 10);
+
+      argv += 2; argc -= 2;
+      continue;
+    }
+
+    if (UtilStrCaseCmp(opt_str, "strategy") == 0)
+    {
+      if (argc < 2)
+      {
+        SetErrorMsg("Missing strategy");
+        cur_comms = NULL;
+        return GLBSP_E_BadArgs;
+      }
+
+      if (UtilStrCaseCmp(argv[1], "normal") == 0)
+        info->build_strategy = STRATEGY_NORMAL;
+      else if (UtilStrCaseCmp(argv[1], "boundary") == 0)
+        info->build_strategy = STRATEGY_BOUNDARY;
+      else
+      {
+        SetErrorMsg("Unknown strategy: %s", argv[1]);
+        cur_comms = NULL;
+        return GLBSP_E_BadArgs;
+      }
+
+      argv += 2; argc -= 2;
+      continue;
+    }
+
     HANDLE_BOOLEAN2("q",  "quiet",      quiet)
     HANDLE_BOOLEAN2("f",  "fast",       fast)
     HANDLE_BOOLEAN2("w",  "warn",       mini_warnings)
@@ -272,6 +380,8 @@ glbsp_ret_e GlbspParseArgs(nodebuildinfo_t *info,
     HANDLE_BOOLEAN2("m",  "mergevert",   merge_vert)
     HANDLE_BOOLEAN2("u",  "prunesec",    prune_sect)
     HANDLE_BOOLEAN2("y",  "windowfx",    window_fx)
+    HANDLE_BOOLEAN2("bt", "blocktail",   block_tails)
+    HANDLE_BOOLEAN2("bz", "blocknozero", block_nozero)
     HANDLE_BOOLEAN2("s",  "skipselfref", skip_self_ref)
     HANDLE_BOOLEAN2("xu", "noprune",     no_prune)
     HANDLE_BOOLEAN2("xn", "nonormal",    no_normal)
@@ -399,6 +509,42 @@ glbsp_ret_e GlbspCheckInfo(nodebuildinfo_t *info,
     return GLBSP_E_BadInfoFixed;
   }
 
+  if (info->num_threads < 0 || info->num_threads > 64)
+  {
+    info->num_threads = 0;
+    SetErrorMsg("Bad threads value !");
+    return GLBSP_E_BadInfoFixed;
+  }
+
+  if (info->zlib_level < 0 || info->zlib_level > 9)
+  {
+    info->zlib_level = DEFAULT_ZLIB_LEVEL;
+    SetErrorMsg("Bad zlevel value !");
+    return GLBSP_E_BadInfoFixed;
+  }
+
+  if (info->reject_level < REJECT_FAST || info->reject_level > REJECT_FULL)
+  {
+    info->reject_level = REJECT_FAST;
+    SetErrorMsg("Bad reject level !");
+    return GLBSP_E_BadInfoFixed;
+  }
+
+  if (info->reject_dist < 0)
+  {
+    info->reject_dist = 0;
+    SetErrorMsg("Bad rejectdist value !");
+    return GLBSP_E_BadInfoFixed;
+  }
+
+  if (info->build_strategy < STRATEGY_NORMAL ||
+      info->build_strategy > STRATEGY_BOUNDARY)
+  {
+    info->build_strategy = STRATEGY_NORMAL;
+    SetErrorMsg("Bad strategy !");
+    return GLBSP_E_BadInfoFixed;
+  }
+
   return GLBSP_E_OK;
 }
 
@@ -451,10 +597,14 @@ static glbsp_ret_e HandleLevel(void)
 
   FindLimits(seg_list, &seg_bbox);
 
+  CreateSplitTable();
+
   // recursively create nodes
   ret = BuildNodes(seg_list, &root_node, &root_sub, 0, &seg_bbox);
   FreeSuper(seg_list);
 
+  FreeSplitTable();
+
   if (ret == GLBSP_E_OK)
   {
     ClockwiseBspTree(root_node);
@@ -468,6 +618,10 @@ static glbsp_ret_e HandleLevel(void)
           ComputeBspHeight(root_node->l.node));
 
     SaveLevel(root_node);
+
+    // the REJECT builder may have stopped early
+    if (cur_comms->cancelled)
+      ret = GLBSP_E_Cancelled;
   }
 
   FreeLevel();
@@ -531,6 +685,16 @@ glbsp_ret_e GlbspBuildNodes(const nodebuildinfo_t *info,
     SetErrorMsg("No levels found in wad !");
     return GLBSP_E_Unknown;
   }
+
+  // with the pipeline, levels are written out as they get built
+  ret = StartPipeline(cur_info->output_file);
+
+  if (ret != GLBSP_E_OK)
+  {
+    CloseWads();
+    TermDebug();
+    return ret;
+  }
    
   PrintMsg("\n");
   PrintVerbose("Creating nodes using tunable factor of %d\n", info->factor);
@@ -105,9 +105,30 @@ typedef struct nodebuildinfo_s
   boolean_g merge_vert;
   boolean_g skip_self_ref;
   boolean_g window_fx;
+  boolean_g block_tails;
+  boolean_g block_nozero;
 
   int block_limit;
 
+  // number of helper threads, 0 for one per CPU.  A value of 1
+  // disables all threading (e.g. the read/build/write pipeline).
+  int num_threads;
+
+  // zlib compression level for ZDoom format nodes, from 0 (store
+  // only) to 9 (best).
+  int zlib_level;
+
+  // how hard to work on the REJECT lump (one of the REJECT_XXX
+  // values below).
+  int reject_level;
+
+  // sectors further apart than this are rejected (0 for no limit).
+  int reject_dist;
+
+  // how to choose the partition lines (one of the STRATEGY_XXX
+  // values below).
+  int build_strategy;
+
   // private stuff -- values computed in GlbspParseArgs or
   // GlbspCheckInfo that need to be passed to GlbspBuildNodes.
 
@@ -116,6 +137,19 @@ typedef struct nodebuildinfo_s
 }
 nodebuildinfo_t;
 
+// values for reject_level.  Fast only finds the isolated groups of
+// sectors, the others check lines of sight too (full being more
+// precise, and normal giving up on very complex sectors).
+#define REJECT_FAST    0
+#define REJECT_NORMAL  1
+#define REJECT_FULL    2
+
+// values for build_strategy.  Boundary first splits large groups of
+// segs along long runs of collinear sector boundaries, and only uses
+// the normal (slow) search on the smaller groups which remain.
+#define STRATEGY_NORMAL    0
+#define STRATEGY_BOUNDARY  1
+
 // This is for two-way communication (esp. with the GUI).
 // Should be flagged 'volatile' since multiple threads (real or
 // otherwise, e.g. signals) may read or change the values.
@@ -120,8 +120,22 @@ subsec_t *NewSubsec(void)
 node_t *NewNode(void)
   ALLIGATOR(node_t, nodes, num_nodes)
 
-wall_tip_t *NewWallTip(void)
-  ALLIGATOR(wall_tip_t, wall_tips, num_wall_tips)
+wall_tip_t *NewWallTips(int count)
+{
+  // like ALLIGATOR, but allocates an array of tips
+
+  if ((num_wall_tips % ALLOC_BLKNUM) == 0)
+  {
+    wall_tips = UtilRealloc(wall_tips, (num_wall_tips + ALLOC_BLKNUM) *
+        sizeof(wall_tip_t *));
+  }
+
+  wall_tips[num_wall_tips] = (wall_tip_t *) UtilCalloc(count *
+      sizeof(wall_tip_t));
+  num_wall_tips += 1;
+
+  return wall_tips[num_wall_tips - 1];
+}
 
 
 /* ----- free routines ---------------------------- */
@@ -250,16 +264,22 @@ void GetVertices(void)
 
   raw = (raw_vertex_t *) lump->data;
 
+  // convert to native order here, and back again at the end (the
+  // lump may be written out unchanged).
+  Endian_Array16(lump->data, count * sizeof(raw_vertex_t) / 2);
+
   for (i=0; i < count; i++, raw++)
   {
     vertex_t *vert = NewVertex();
 
-    vert->x = (float_g) SINT16(raw->x);
-    vert->y = (float_g) SINT16(raw->y);
+    vert->x = (float_g) raw->x;
+    vert->y = (float_g) raw->y;
 
     vert->index = i;
   }
 
+  Endian_Array16(lump->data, count * sizeof(raw_vertex_t) / 2);
+
   num_normal_vert = num_vertices;
   num_gl_vert = 0;
   num_complete_seg = 0;
@@ -342,18 +362,22 @@ void GetThings(void)
 
   raw = (raw_thing_t *) lump->data;
 
+  Endian_Array16(lump->data, count * sizeof(raw_thing_t) / 2);
+
   for (i=0; i < count; i++, raw++)
   {
     thing_t *thing = NewThing();
 
-    thing->x = SINT16(raw->x);
-    thing->y = SINT16(raw->y);
+    thing->x = raw->x;
+    thing->y = raw->y;
 
-    thing->type = UINT16(raw->type);
-    thing->options = UINT16(raw->options);
+    thing->type = raw->type;
+    thing->options = raw->options;
 
     thing->index = i;
   }
+
+  Endian_Array16(lump->data, count * sizeof(raw_thing_t) / 2);
 }
 
 //
@@ -428,9 +452,6 @@ void GetSidedefs(void)
     side->sector = (SINT16(raw->sector) == -1) ? NULL :
         LookupSector(UINT16(raw->sector));
 
-    if (side->sector)
-      side->sector->ref_count++;
-
     side->x_offset = SINT16(raw->x_offset);
     side->y_offset = SINT16(raw->y_offset);
 
@@ -477,15 +498,14 @@ void GetLinedefs(void)
 
   raw = (raw_linedef_t *) lump->data;
 
+  Endian_Array16(lump->data, count * sizeof(raw_linedef_t) / 2);
+
   for (i=0; i < count; i++, raw++)
   {
     linedef_t *line;
 
-    vertex_t *start = LookupVertex(UINT16(raw->start));
-    vertex_t *end   = LookupVertex(UINT16(raw->end));
-
-    start->ref_count++;
-    end->ref_count++;
+    vertex_t *start = LookupVertex(raw->start);
+    vertex_t *end   = LookupVertex(raw->end);
 
     line = NewLinedef();
 
@@ -496,34 +516,30 @@ void GetLinedefs(void)
     line->zero_len = (fabs(start->x - end->x) < DIST_EPSILON) && 
         (fabs(start->y - end->y) < DIST_EPSILON);
 
-    line->flags = UINT16(raw->flags);
-    line->type = UINT16(raw->type);
-    line->tag  = SINT16(raw->tag);
+    line->flags = raw->flags;
+    line->type = raw->type;
+    line->tag  = raw->tag;
 
     line->two_sided = (line->flags & LINEFLAG_TWO_SIDED) ? TRUE : FALSE;
     line->is_precious = (line->tag >= 900 && line->tag < 1000) ? 
         TRUE : FALSE;
 
-    line->right = SafeLookupSidedef(UINT16(raw->sidedef1));
-    line->left  = SafeLookupSidedef(UINT16(raw->sidedef2));
+    line->right = SafeLookupSidedef(raw->sidedef1);
+    line->left  = SafeLookupSidedef(raw->sidedef2);
 
     if (line->right)
-    {
-      line->right->ref_count++;
       line->right->on_special |= (line->type > 0) ? 1 : 0;
-    }
 
     if (line->left)
-    {
-      line->left->ref_count++;
       line->left->on_special |= (line->type > 0) ? 1 : 0;
-    }
 
     line->self_ref = (line->left && line->right &&
         (line->left->sector == line->right->sector));
 
     line->index = i;
   }
+
+  Endian_Array16(lump->data, count * sizeof(raw_linedef_t) / 2);
 }
 
 //
@@ -556,9 +572,6 @@ void GetLinedefsHexen(void)
     vertex_t *start = LookupVertex(UINT16(raw->start));
     vertex_t *end   = LookupVertex(UINT16(raw->end));
 
-    start->ref_count++;
-    end->ref_count++;
-
     line = NewLinedef();
 
     line->start = start;
@@ -582,18 +595,11 @@ void GetLinedefsHexen(void)
     line->right = SafeLookupSidedef(UINT16(raw->sidedef1));
     line->left  = SafeLookupSidedef(UINT16(raw->sidedef2));
 
-    // -JL- Added missing sidedef handling that caused all sidedefs to be pruned
     if (line->right)
-    {
-      line->right->ref_count++;
       line->right->on_special |= (line->type > 0) ? 1 : 0;
-    }
 
     if (line->left)
-    {
-      line->left->ref_count++;
       line->left->on_special |= (line->type > 0) ? 1 : 0;
-    }
 
     line->self_ref = (line->left && line->right &&
         (line->left->sector == line->right->sector));
@@ -647,7 +653,10 @@ static const uint8_g *lev_v5_magic = (uint8_g *) "gNd5";
 void PutVertices(char *name, int do_gl)
 {
   int count, i;
+  int total = do_gl ? num_gl_vert : num_normal_vert;
+
   lump_t *lump;
+  raw_vertex_t *raw;
 
   DisplayTicker();
 
@@ -656,9 +665,10 @@ void PutVertices(char *name, int do_gl)
   else
     lump = CreateLevelLump(name);
 
+  raw = (raw_vertex_t *) ExtendLevelLump(lump, total * sizeof(raw_vertex_t));
+
   for (i=0, count=0; i < num_vertices; i++)
   {
-    raw_vertex_t raw;
     vertex_t *vert = lev_vertices[i];
 
     if ((do_gl ? 1 : 0) != ((vert->index & IS_GL_VERTEX) ? 1 : 0))
@@ -666,17 +676,19 @@ void PutVertices(char *name, int do_gl)
       continue;
     }
 
-    raw.x = SINT16(I_ROUND(vert->x));
-    raw.y = SINT16(I_ROUND(vert->y));
+    if (count >= total)
+      InternalError("PutVertices miscounted (> %d)", total);
 
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw[count].x = (sint16_g) I_ROUND(vert->x);
+    raw[count].y = (sint16_g) I_ROUND(vert->y);
 
     count++;
   }
 
-  if (count != (do_gl ? num_gl_vert : num_normal_vert))
-    InternalError("PutVertices miscounted (%d != %d)", count,
-      do_gl ? num_gl_vert : num_normal_vert);
+  Endian_Array16(raw, total * sizeof(raw_vertex_t) / 2);
+
+  if (count != total)
+    InternalError("PutVertices miscounted (%d != %d)", count, total);
 
   if (lev_doing_normal && ! do_gl && count > 65534)
     MarkHardFailure(LIMIT_VERTEXES);
@@ -688,6 +700,7 @@ void PutV2Vertices(int do_v5)
 {
   int count, i;
   lump_t *lump;
+  raw_v2_vertex_t *raw;
 
   DisplayTicker();
 
@@ -698,22 +711,27 @@ void PutV2Vertices(int do_v5)
   else
       AppendLevelLump(lump, lev_v2_magic, 4);
 
+  raw = (raw_v2_vertex_t *) ExtendLevelLump(lump,
+      num_gl_vert * sizeof(raw_v2_vertex_t));
+
   for (i=0, count=0; i < num_vertices; i++)
   {
-    raw_v2_vertex_t raw;
     vertex_t *vert = lev_vertices[i];
 
     if (! (vert->index & IS_GL_VERTEX))
       continue;
 
-    raw.x = SINT32((int)(vert->x * 65536.0));
-    raw.y = SINT32((int)(vert->y * 65536.0));
+    if (count >= num_gl_vert)
+      InternalError("PutV2Vertices miscounted (> %d)", num_gl_vert);
 
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw[count].x = (int)(vert->x * 65536.0);
+    raw[count].y = (int)(vert->y * 65536.0);
 
     count++;
   }
 
+  Endian_Array32(raw, num_gl_vert * sizeof(raw_v2_vertex_t) / 4);
+
   if (count != num_gl_vert)
     InternalError("PutV2Vertices miscounted (%d != %d)", count,
       num_gl_vert);
@@ -726,25 +744,26 @@ void PutSectors(void)
 {
   int i;
   lump_t *lump = CreateLevelLump("SECTORS");
+  raw_sector_t *raw;
 
   DisplayTicker();
 
-  for (i=0; i < num_sectors; i++)
+  raw = (raw_sector_t *) ExtendLevelLump(lump,
+      num_sectors * sizeof(raw_sector_t));
+
+  for (i=0; i < num_sectors; i++, raw++)
   {
-    raw_sector_t raw;
     sector_t *sector = lev_sectors[i];
 
-    raw.floor_h = SINT16(sector->floor_h);
-    raw.ceil_h  = SINT16(sector->ceil_h);
-
-    memcpy(raw.floor_tex, sector->floor_tex, sizeof(raw.floor_tex));
-    memcpy(raw.ceil_tex,  sector->ceil_tex,  sizeof(raw.ceil_tex));
+    raw->floor_h = SINT16(sector->floor_h);
+    raw->ceil_h  = SINT16(sector->ceil_h);
 
-    raw.light = UINT16(sector->light);
-    raw.special = UINT16(sector->special);
-    raw.tag   = SINT16(sector->tag);
+    memcpy(raw->floor_tex, sector->floor_tex, sizeof(raw->floor_tex));
+    memcpy(raw->ceil_tex,  sector->ceil_tex,  sizeof(raw->ceil_tex));
 
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw->light = UINT16(sector->light);
+    raw->special = UINT16(sector->special);
+    raw->tag   = SINT16(sector->tag);
   }
 
   if (num_sectors > 65534)
@@ -757,25 +776,26 @@ void PutSidedefs(void)
 {
   int i;
   lump_t *lump = CreateLevelLump("SIDEDEFS");
+  raw_sidedef_t *raw;
 
   DisplayTicker();
 
-  for (i=0; i < num_sidedefs; i++)
+  raw = (raw_sidedef_t *) ExtendLevelLump(lump,
+      num_sidedefs * sizeof(raw_sidedef_t));
+
+  for (i=0; i < num_sidedefs; i++, raw++)
   {
-    raw_sidedef_t raw;
     sidedef_t *side = lev_sidedefs[i];
 
-    raw.sector = (side->sector == NULL) ? SINT16(-1) :
+    raw->sector = (side->sector == NULL) ? SINT16(-1) :
         UINT16(side->sector->index);
 
-    raw.x_offset = SINT16(side->x_offset);
-    raw.y_offset = SINT16(side->y_offset);
+    raw->x_offset = SINT16(side->x_offset);
+    raw->y_offset = SINT16(side->y_offset);
 
-    memcpy(raw.upper_tex, side->upper_tex, sizeof(raw.upper_tex));
-    memcpy(raw.lower_tex, side->lower_tex, sizeof(raw.lower_tex));
-    memcpy(raw.mid_tex,   side->mid_tex,   sizeof(raw.mid_tex));
- 
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    memcpy(raw->upper_tex, side->upper_tex, sizeof(raw->upper_tex));
+    memcpy(raw->lower_tex, side->lower_tex, sizeof(raw->lower_tex));
+    memcpy(raw->mid_tex,   side->mid_tex,   sizeof(raw->mid_tex));
   }
 
   if (num_sidedefs > 65534)
@@ -788,27 +808,30 @@ void PutLinedefs(void)
 {
   int i;
   lump_t *lump = CreateLevelLump("LINEDEFS");
+  raw_linedef_t *raw;
 
   DisplayTicker();
 
+  raw = (raw_linedef_t *) ExtendLevelLump(lump,
+      num_linedefs * sizeof(raw_linedef_t));
+
   for (i=0; i < num_linedefs; i++)
   {
-    raw_linedef_t raw;
     linedef_t *line = lev_linedefs[i];
 
-    raw.start = UINT16(line->start->index);
-    raw.end   = UINT16(line->end->index);
-
-    raw.flags = UINT16(line->flags);
-    raw.type  = UINT16(line->type);
-    raw.tag   = SINT16(line->tag);
+    raw[i].start = line->start->index;
+    raw[i].end   = line->end->index;
 
-    raw.sidedef1 = line->right ? UINT16(line->right->index) : 0xFFFF;
-    raw.sidedef2 = line->left  ? UINT16(line->left->index)  : 0xFFFF;
+    raw[i].flags = line->flags;
+    raw[i].type  = line->type;
+    raw[i].tag   = (sint16_g) line->tag;
 
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw[i].sidedef1 = line->right ? line->right->index : 0xFFFF;
+    raw[i].sidedef2 = line->left  ? line->left->index  : 0xFFFF;
   }
 
+  Endian_Array16(raw, num_linedefs * sizeof(raw_linedef_t) / 2);
+
   if (num_linedefs > 65534)
     MarkHardFailure(LIMIT_LINEDEFS);
   else if (num_linedefs > 32767)
@@ -819,28 +842,29 @@ void PutLinedefsHexen(void)
 {
   int i, j;
   lump_t *lump = CreateLevelLump("LINEDEFS");
+  raw_hexen_linedef_t *raw;
 
   DisplayTicker();
 
-  for (i=0; i < num_linedefs; i++)
+  raw = (raw_hexen_linedef_t *) ExtendLevelLump(lump,
+      num_linedefs * sizeof(raw_hexen_linedef_t));
+
+  for (i=0; i < num_linedefs; i++, raw++)
   {
-    raw_hexen_linedef_t raw;
     linedef_t *line = lev_linedefs[i];
 
-    raw.start = UINT16(line->start->index);
-    raw.end   = UINT16(line->end->index);
+    raw->start = UINT16(line->start->index);
+    raw->end   = UINT16(line->end->index);
 
-    raw.flags = UINT16(line->flags);
-    raw.type  = UINT8(line->type);
+    raw->flags = UINT16(line->flags);
+    raw->type  = UINT8(line->type);
 
     // write specials
     for (j=0; j < 5; j++)
-      raw.specials[j] = UINT8(line->specials[j]);
-
-    raw.sidedef1 = line->right ? UINT16(line->right->index) : 0xFFFF;
-    raw.sidedef2 = line->left  ? UINT16(line->left->index)  : 0xFFFF;
+      raw->specials[j] = UINT8(line->specials[j]);
 
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw->sidedef1 = line->right ? UINT16(line->right->index) : 0xFFFF;
+    raw->sidedef2 = line->left  ? UINT16(line->left->index)  : 0xFFFF;
   }
 
   if (num_linedefs > 65534)
@@ -869,41 +893,48 @@ void PutSegs(void)
 {
   int i, count;
   lump_t *lump = CreateLevelLump("SEGS");
+  raw_seg_t *raw;
 
   DisplayTicker();
 
   // sort segs into ascending index
   qsort(segs, num_segs, sizeof(seg_t *), SegCompare);
 
+  raw = (raw_seg_t *) ExtendLevelLump(lump,
+      num_complete_seg * sizeof(raw_seg_t));
+
   for (i=0, count=0; i < num_segs; i++)
   {
-    raw_seg_t raw;
     seg_t *seg = segs[i];
 
     // ignore minisegs and degenerate segs
     if (! seg->linedef || seg->degenerate)
       continue;
 
-    raw.start   = UINT16(VertexIndex16Bit(seg->start));
-    raw.end     = UINT16(VertexIndex16Bit(seg->end));
-    raw.angle   = UINT16(TransformAngle(seg->p_angle));
-    raw.linedef = UINT16(seg->linedef->index);
-    raw.flip    = UINT16(seg->side);
-    raw.dist    = UINT16(TransformSegDist(seg));
+    if (count >= num_complete_seg)
+      InternalError("PutSegs miscounted (> %d)", num_complete_seg);
 
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw[count].start   = VertexIndex16Bit(seg->start);
+    raw[count].end     = VertexIndex16Bit(seg->end);
+    raw[count].angle   = TransformAngle(seg->p_angle);
+    raw[count].linedef = seg->linedef->index;
+    raw[count].flip    = seg->side;
+    raw[count].dist    = TransformSegDist(seg);
 
-    count++;
 
 #   if DEBUG_BSP
     PrintDebug("PUT SEG: %04X  Vert %04X->%04X  Line %04X %s  "
         "Angle %04X  (%1.1f,%1.1f) -> (%1.1f,%1.1f)\n", seg->index,
-        UINT16(raw.start), UINT16(raw.end), UINT16(raw.linedef), 
-        seg->side ? "L" : "R", UINT16(raw.angle), 
+        raw[count].start, raw[count].end, raw[count].linedef, 
+        seg->side ? "L" : "R", raw[count].angle, 
         seg->start->x, seg->start->y, seg->end->x, seg->end->y);
 #   endif
+
+    count++;
   }
 
+  Endian_Array16(raw, num_complete_seg * sizeof(raw_seg_t) / 2);
+
   if (count != num_complete_seg)
     InternalError("PutSegs miscounted (%d != %d)", count,
       num_complete_seg);
@@ -918,47 +949,54 @@ void PutGLSegs(void)
 {
   int i, count;
   lump_t *lump = CreateGLLump("GL_SEGS");
+  raw_gl_seg_t *raw;
 
   DisplayTicker();
 
   // sort segs into ascending index
   qsort(segs, num_segs, sizeof(seg_t *), SegCompare);
 
+  raw = (raw_gl_seg_t *) ExtendLevelLump(lump,
+      num_complete_seg * sizeof(raw_gl_seg_t));
+
   for (i=0, count=0; i < num_segs; i++)
   {
-    raw_gl_seg_t raw;
     seg_t *seg = segs[i];
 
     // ignore degenerate segs
     if (seg->degenerate)
       continue;
 
-    raw.start = UINT16(VertexIndex16Bit(seg->start));
-    raw.end   = UINT16(VertexIndex16Bit(seg->end));
-    raw.side  = UINT16(seg->side);
+    if (count >= num_complete_seg)
+      InternalError("PutGLSegs miscounted (> %d)", num_complete_seg);
+
+    raw[count].start = VertexIndex16Bit(seg->start);
+    raw[count].end   = VertexIndex16Bit(seg->end);
+    raw[count].side  = seg->side;
 
     if (seg->linedef)
-      raw.linedef = UINT16(seg->linedef->index);
+      raw[count].linedef = seg->linedef->index;
     else
-      raw.linedef = UINT16(0xFFFF);
+      raw[count].linedef = 0xFFFF;
 
     if (seg->partner)
-      raw.partner = UINT16(seg->partner->index);
+      raw[count].partner = seg->partner->index;
     else
-      raw.partner = UINT16(0xFFFF);
+      raw[count].partner = 0xFFFF;
 
-    AppendLevelLump(lump, &raw, sizeof(raw));
-
-    count++;
 
 #   if DEBUG_BSP
     PrintDebug("PUT GL SEG: %04X  Line %04X %s  Partner %04X  "
-      "(%1.1f,%1.1f) -> (%1.1f,%1.1f)\n", seg->index, UINT16(raw.linedef), 
-      seg->side ? "L" : "R", UINT16(raw.partner),
+      "(%1.1f,%1.1f) -> (%1.1f,%1.1f)\n", seg->index, raw[count].linedef, 
+      seg->side ? "L" : "R", raw[count].partner,
       seg->start->x, seg->start->y, seg->end->x, seg->end->y);
 #   endif
+
+    count++;
   }
 
+  Endian_Array16(raw, num_complete_seg * sizeof(raw_gl_seg_t) / 2);
+
   if (count != num_complete_seg)
     InternalError("PutGLSegs miscounted (%d != %d)", count,
       num_complete_seg);
@@ -973,6 +1011,7 @@ void PutV3Segs(int do_v5)
 {
   int i, count;
   lump_t *lump = CreateGLLump("GL_SEGS");
+  raw_v3_seg_t *raw;
 
   if (! do_v5)
       AppendLevelLump(lump, lev_v3_magic, 4);
@@ -982,48 +1021,53 @@ void PutV3Segs(int do_v5)
   // sort segs into ascending index
   qsort(segs, num_segs, sizeof(seg_t *), SegCompare);
 
+  raw = (raw_v3_seg_t *) ExtendLevelLump(lump,
+      num_complete_seg * sizeof(raw_v3_seg_t));
+
   for (i=0, count=0; i < num_segs; i++)
   {
-    raw_v3_seg_t raw;
     seg_t *seg = segs[i];
 
     // ignore degenerate segs
     if (seg->degenerate)
       continue;
 
+    if (count >= num_complete_seg)
+      InternalError("PutV3Segs miscounted (> %d)", num_complete_seg);
+
     if (do_v5)
     {
-      raw.start = UINT32(VertexIndex32BitV5(seg->start));
-      raw.end   = UINT32(VertexIndex32BitV5(seg->end));
+      raw->start = UINT32(VertexIndex32BitV5(seg->start));
+      raw->end   = UINT32(VertexIndex32BitV5(seg->end));
     }
     else
     {
-      raw.start = UINT32(seg->start->index);
-      raw.end   = UINT32(seg->end->index);
+      raw->start = UINT32(seg->start->index);
+      raw->end   = UINT32(seg->end->index);
     }
 
-    raw.side  = UINT16(seg->side);
+    raw->side  = UINT16(seg->side);
 
     if (seg->linedef)
-      raw.linedef = UINT16(seg->linedef->index);
+      raw->linedef = UINT16(seg->linedef->index);
     else
-      raw.linedef = UINT16(0xFFFF);
+      raw->linedef = UINT16(0xFFFF);
 
     if (seg->partner)
-      raw.partner = UINT32(seg->partner->index);
+      raw->partner = UINT32(seg->partner->index);
     else
-      raw.partner = UINT32(0xFFFFFFFF);
-
-    AppendLevelLump(lump, &raw, sizeof(raw));
+      raw->partner = UINT32(0xFFFFFFFF);
 
     count++;
 
 #   if DEBUG_BSP
     PrintDebug("PUT V3 SEG: %06X  Line %04X %s  Partner %06X  "
-      "(%1.1f,%1.1f) -> (%1.1f,%1.1f)\n", seg->index, UINT16(raw.linedef), 
-      seg->side ? "L" : "R", UINT32(raw.partner),
+      "(%1.1f,%1.1f) -> (%1.1f,%1.1f)\n", seg->index, UINT16(raw->linedef), 
+      seg->side ? "L" : "R", UINT32(raw->partner),
       seg->start->x, seg->start->y, seg->end->x, seg->end->y);
 #   endif
+
+    raw++;
   }
 
   if (count != num_complete_seg)
@@ -1035,6 +1079,7 @@ void PutSubsecs(char *name, int do_gl)
 {
   int i;
   lump_t *lump;
+  raw_subsec_t *raw;
 
   DisplayTicker();
 
@@ -1043,22 +1088,24 @@ void PutSubsecs(char *name, int do_gl)
   else
     lump = CreateLevelLump(name);
 
+  raw = (raw_subsec_t *) ExtendLevelLump(lump,
+      num_subsecs * sizeof(raw_subsec_t));
+
   for (i=0; i < num_subsecs; i++)
   {
-    raw_subsec_t raw;
     subsec_t *sub = subsecs[i];
 
-    raw.first = UINT16(sub->seg_list->index);
-    raw.num   = UINT16(sub->seg_count);
-
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw[i].first = sub->seg_list->index;
+    raw[i].num   = sub->seg_count;
 
 #   if DEBUG_BSP
     PrintDebug("PUT SUBSEC %04X  First %04X  Num %04X\n",
-      sub->index, UINT16(raw.first), UINT16(raw.num));
+      sub->index, raw[i].first, raw[i].num);
 #   endif
   }
 
+  Endian_Array16(raw, num_subsecs * sizeof(raw_subsec_t) / 2);
+
   if (num_subsecs > 32767)
     MarkHardFailure(do_gl ? LIMIT_GL_SSECT : LIMIT_SSECTORS);
 }
@@ -1067,6 +1114,7 @@ void PutV3Subsecs(int do_v5)
 {
   int i;
   lump_t *lump;
+  raw_v3_subsec_t *raw;
 
   DisplayTicker();
 
@@ -1075,126 +1123,134 @@ void PutV3Subsecs(int do_v5)
   if (! do_v5)
       AppendLevelLump(lump, lev_v3_magic, 4);
 
+  raw = (raw_v3_subsec_t *) ExtendLevelLump(lump,
+      num_subsecs * sizeof(raw_v3_subsec_t));
+
   for (i=0; i < num_subsecs; i++)
   {
-    raw_v3_subsec_t raw;
     subsec_t *sub = subsecs[i];
 
-    raw.first = UINT32(sub->seg_list->index);
-    raw.num   = UINT32(sub->seg_count);
-
-    AppendLevelLump(lump, &raw, sizeof(raw));
+    raw[i].first = sub->seg_list->index;
+    raw[i].num   = sub->seg_count;
 
 #   if DEBUG_BSP
     PrintDebug("PUT V3 SUBSEC %06X  First %06X  Num %06X\n",
-      sub->index, UINT32(raw.first), UINT32(raw.num));
+      sub->index, raw[i].first, raw[i].num);
 #   endif
   }
 
+  Endian_Array32(raw, num_subsecs * sizeof(raw_v3_subsec_t) / 4);
+
   if (!do_v5 && num_subsecs > 32767)
     MarkHardFailure(LIMIT_GL_SSECT);
 }
 
 static int node_cur_index;
 
-static void PutOneNode(node_t *node, lump_t *lump)
+static void PutOneNode(node_t *node, raw_node_t *base)
 {
-  raw_node_t raw;
+  raw_node_t *raw;
 
   if (node->r.node)
-    PutOneNode(node->r.node, lump);
+    PutOneNode(node->r.node, base);
 
   if (node->l.node)
-    PutOneNode(node->l.node, lump);
+    PutOneNode(node->l.node, base);
 
   node->index = node_cur_index++;
 
-  raw.x  = SINT16(node->x);
-  raw.y  = SINT16(node->y);
-  raw.dx = SINT16(node->dx / (node->too_long ? 2 : 1));
-  raw.dy = SINT16(node->dy / (node->too_long ? 2 : 1));
+  if (node->index >= num_nodes)
+    InternalError("PutNodes miscounted (> %d)", num_nodes);
 
-  raw.b1.minx = SINT16(node->r.bounds.minx);
-  raw.b1.miny = SINT16(node->r.bounds.miny);
-  raw.b1.maxx = SINT16(node->r.bounds.maxx);
-  raw.b1.maxy = SINT16(node->r.bounds.maxy);
+  raw = base + node->index;
 
-  raw.b2.minx = SINT16(node->l.bounds.minx);
-  raw.b2.miny = SINT16(node->l.bounds.miny);
-  raw.b2.maxx = SINT16(node->l.bounds.maxx);
-  raw.b2.maxy = SINT16(node->l.bounds.maxy);
+  raw->x  = (sint16_g) node->x;
+  raw->y  = (sint16_g) node->y;
+  raw->dx = (sint16_g) (node->dx / (node->too_long ? 2 : 1));
+  raw->dy = (sint16_g) (node->dy / (node->too_long ? 2 : 1));
+
+  raw->b1.minx = (sint16_g) node->r.bounds.minx;
+  raw->b1.miny = (sint16_g) node->r.bounds.miny;
+  raw->b1.maxx = (sint16_g) node->r.bounds.maxx;
+  raw->b1.maxy = (sint16_g) node->r.bounds.maxy;
+
+  raw->b2.minx = (sint16_g) node->l.bounds.minx;
+  raw->b2.miny = (sint16_g) node->l.bounds.miny;
+  raw->b2.maxx = (sint16_g) node->l.bounds.maxx;
+  raw->b2.maxy = (sint16_g) node->l.bounds.maxy;
 
   if (node->r.node)
-    raw.right = UINT16(node->r.node->index);
+    raw->right = node->r.node->index;
   else if (node->r.subsec)
-    raw.right = UINT16(node->r.subsec->index | 0x8000);
+    raw->right = node->r.subsec->index | 0x8000;
   else
     InternalError("Bad right child in node %d", node->index);
 
   if (node->l.node)
-    raw.left = UINT16(node->l.node->index);
+    raw->left = node->l.node->index;
   else if (node->l.subsec)
-    raw.left = UINT16(node->l.subsec->index | 0x8000);
+    raw->left = node->l.subsec->index | 0x8000;
   else
     InternalError("Bad left child in node %d", node->index);
 
-  AppendLevelLump(lump, &raw, sizeof(raw));
-
 # if DEBUG_BSP
   PrintDebug("PUT NODE %04X  Left %04X  Right %04X  "
-    "(%d,%d) -> (%d,%d)\n", node->index, UINT16(raw.left),
-    UINT16(raw.right), node->x, node->y,
+    "(%d,%d) -> (%d,%d)\n", node->index, raw->left,
+    raw->right, node->x, node->y,
     node->x + node->dx, node->y + node->dy);
 # endif
 }
 
-static void PutOneV5Node(node_t *node, lump_t *lump)
+static void PutOneV5Node(node_t *node, raw_v5_node_t *base)
 {
-  raw_v5_node_t raw;
+  raw_v5_node_t *raw;
 
   if (node->r.node)
-    PutOneV5Node(node->r.node, lump);
+    PutOneV5Node(node->r.node, base);
 
   if (node->l.node)
-    PutOneV5Node(node->l.node, lump);
+    PutOneV5Node(node->l.node, base);
 
   node->index = node_cur_index++;
 
-  raw.x  = SINT16(node->x);
-  raw.y  = SINT16(node->y);
-  raw.dx = SINT16(node->dx / (node->too_long ? 2 : 1));
-  raw.dy = SINT16(node->dy / (node->too_long ? 2 : 1));
+  if (node->index >= num_nodes)
+    InternalError("PutNodes miscounted (> %d)", num_nodes);
 
-  raw.b1.minx = SINT16(node->r.bounds.minx);
-  raw.b1.miny = SINT16(node->r.bounds.miny);
-  raw.b1.maxx = SINT16(node->r.bounds.maxx);
-  raw.b1.maxy = SINT16(node->r.bounds.maxy);
+  raw = base + node->index;
 
-  raw.b2.minx = SINT16(node->l.bounds.minx);
-  raw.b2.miny = SINT16(node->l.bounds.miny);
-  raw.b2.maxx = SINT16(node->l.bounds.maxx);
-  raw.b2.maxy = SINT16(node->l.bounds.maxy);
+  raw->x  = SINT16(node->x);
+  raw->y  = SINT16(node->y);
+  raw->dx = SINT16(node->dx / (node->too_long ? 2 : 1));
+  raw->dy = SINT16(node->dy / (node->too_long ? 2 : 1));
+
+  raw->b1.minx = SINT16(node->r.bounds.minx);
+  raw->b1.miny = SINT16(node->r.bounds.miny);
+  raw->b1.maxx = SINT16(node->r.bounds.maxx);
+  raw->b1.maxy = SINT16(node->r.bounds.maxy);
+
+  raw->b2.minx = SINT16(node->l.bounds.minx);
+  raw->b2.miny = SINT16(node->l.bounds.miny);
+  raw->b2.maxx = SINT16(node->l.bounds.maxx);
+  raw->b2.maxy = SINT16(node->l.bounds.maxy);
 
   if (node->r.node)
-    raw.right = UINT32(node->r.node->index);
+    raw->right = UINT32(node->r.node->index);
   else if (node->r.subsec)
-    raw.right = UINT32(node->r.subsec->index | 0x80000000U);
+    raw->right = UINT32(node->r.subsec->index | 0x80000000U);
   else
     InternalError("Bad right child in V5 node %d", node->index);
 
   if (node->l.node)
-    raw.left = UINT32(node->l.node->index);
+    raw->left = UINT32(node->l.node->index);
   else if (node->l.subsec)
-    raw.left = UINT32(node->l.subsec->index | 0x80000000U);
+    raw->left = UINT32(node->l.subsec->index | 0x80000000U);
   else
     InternalError("Bad left child in V5 node %d", node->index);
 
-  AppendLevelLump(lump, &raw, sizeof(raw));
-
 # if DEBUG_BSP
   PrintDebug("PUT V5 NODE %08X  Left %08X  Right %08X  "
-    "(%d,%d) -> (%d,%d)\n", node->index, UINT32(raw.left),
-    UINT32(raw.right), node->x, node->y,
+    "(%d,%d) -> (%d,%d)\n", node->index, UINT32(raw->left),
+    UINT32(raw->right), node->x, node->y,
     node->x + node->dx, node->y + node->dy);
 # endif
 }
@@ -1215,9 +1271,17 @@ void PutNodes(char *name, int do_gl, int do_v5, node_t *root)
   if (root)
   {
     if (do_v5)
-      PutOneV5Node(root, lump);
+      PutOneV5Node(root, (raw_v5_node_t *) ExtendLevelLump(lump,
+          num_nodes * sizeof(raw_v5_node_t)));
     else
-      PutOneNode(root, lump);
+    {
+      raw_node_t *raw = (raw_node_t *) ExtendLevelLump(lump,
+          num_nodes * sizeof(raw_node_t));
+
+      PutOneNode(root, raw);
+
+      Endian_Array16(raw, num_nodes * sizeof(raw_node_t) / 2);
+    }
   }
 
   if (node_cur_index != num_nodes)
@@ -1516,32 +1580,32 @@ void LoadLevel(void)
     if (cur_info->merge_vert)
       DetectDuplicateVertices();
 
-    if (!cur_info->no_prune)
-      PruneLinedefs();
-
-    // always prune vertices (ignore -noprune), otherwise all the
-    // unused vertices from seg splits would keep accumulating.
-    PruneVertices();
-
-    if (!cur_info->no_prune)
-      PruneSidedefs();
-
-    if (cur_info->prune_sect)
-      PruneSectors();
+    PruneLevel();
   }
  
+  // the wall tips include the parts of partly overlapped lines
+  DetectOverlappingLines();
+
   CalculateWallTips();
 
+  if (lev_doing_hexen || cur_info->window_fx)
+    CreateLineIndex();
+
   if (lev_doing_hexen)
   {
     // -JL- Find sectors containing polyobjs
     DetectPolyobjSectors();
   }
 
-  DetectOverlappingLines();
-
   if (cur_info->window_fx)
     DetectWindowEffects();
+
+  FreeLineIndex();
+
+  DetectConvexSectors();
+
+  if (cur_info->build_strategy == STRATEGY_BOUNDARY)
+    DetectBoundaryRuns();
 }
 
 //
@@ -1576,6 +1640,17 @@ void PutGLOptions(void)
   if (cur_info->prune_sect   ) strcat(option_buf, " -u");
   if (cur_info->skip_self_ref) strcat(option_buf, " -s");
   if (cur_info->window_fx    ) strcat(option_buf, " -y");
+  if (cur_info->block_tails  ) strcat(option_buf, " -bt");
+  if (cur_info->block_nozero ) strcat(option_buf, " -bz");
+
+  if (cur_info->reject_level == REJECT_NORMAL) strcat(option_buf, " -reject normal");
+  if (cur_info->reject_level == REJECT_FULL  ) strcat(option_buf, " -reject full");
+
+  if (cur_info->reject_dist > 0)
+    sprintf(option_buf + strlen(option_buf), " -rejectdist %d", cur_info->reject_dist);
+
+  if (cur_info->build_strategy == STRATEGY_BOUNDARY)
+    strcat(option_buf, " -strategy boundary");
 
   if (cur_info->no_normal) strcat(option_buf, " -xn");
   if (cur_info->no_reject) strcat(option_buf, " -xr");
@@ -1612,11 +1687,121 @@ void PutGLChecksum(void)
   AddGLTextLine("CHECKSUM", num_buf);
 }
 
+//
+// InputChecksum
+//
+// Computes a checksum of everything the BLOCKMAP lump (or the REJECT
+// lump, when 'reject' is true) is built from, including the options
+// which affect it and the builder version (in case the way it is made
+// changes), and stores it in 'buf'.  A 64-bit hash is used, since a
+// collision would keep a stale lump.
+//
+static void InputChecksum(char *buf, boolean_g reject)
+{
+  fnv64_t hash;
+  uint32_g raw[8];
+  int i, count;
+
+  FNV64_Begin(&hash);
+
+  FNV64_AddBlock(&hash, (const uint8_g *) GLBSP_VER, strlen(GLBSP_VER));
+
+  if (reject)
+  {
+    raw[0] = num_sectors;
+    raw[1] = cur_info->reject_level;
+    raw[2] = cur_info->reject_dist;
+    count  = 3;
+  }
+  else
+  {
+    raw[0] = cur_info->block_limit;
+    raw[1] = cur_info->block_tails;
+    raw[2] = cur_info->block_nozero;
+    count  = 3;
+  }
+
+  raw[count++] = num_linedefs;
+
+  Endian_Array32(raw, count);
+  FNV64_AddBlock(&hash, (uint8_g *) raw, count * 4);
+
+  for (i=0; i < num_linedefs; i++)
+  {
+    linedef_t *L = LookupLinedef(i);
+
+    count = 0;
+
+    // the simple REJECT doesn't care where the lines are
+    if (! reject || cur_info->reject_level != REJECT_FAST ||
+        cur_info->reject_dist > 0)
+    {
+      raw[count++] = (int) L->start->x;
+      raw[count++] = (int) L->start->y;
+      raw[count++] = (int) L->end->x;
+      raw[count++] = (int) L->end->y;
+    }
+
+    raw[count++] = L->zero_len;
+
+    if (reject)
+    {
+      raw[count++] = L->two_sided;
+      raw[count++] = (L->right && L->right->sector) ? L->right->sector->index : -1;
+      raw[count++] = (L->left  && L->left->sector)  ? L->left->sector->index  : -1;
+    }
+
+    Endian_Array32(raw, count);
+    FNV64_AddBlock(&hash, (uint8_g *) raw, count * 4);
+  }
+
+  FNV64_Finish(&hash);
+
+  sprintf(buf, "0x%08x%08x", hash.hi, hash.lo);
+}
+
+//
+// KeepOldLump
+//
+// Checks whether the given lump from the input wad can be kept: it
+// must have been made by a previous build from the same inputs (the
+// checksum is in the old GL marker) and have a sensible length
+// (exactly 'length' unless that is negative).
+//
+static boolean_g KeepOldLump(const char *name, const char *keyword,
+    const char *sum, int length)
+{
+  lump_t *lump = FindLevelLump(name);
+  char *old_sum;
+  boolean_g match;
+
+  if (! lump || lump->length == 0)
+    return FALSE;
+
+  if (length >= 0 && lump->length != length)
+    return FALSE;
+
+  old_sum = GetOldGLValue(keyword);
+
+  if (! old_sum)
+    return FALSE;
+
+  match = (strcmp(old_sum, sum) == 0);
+
+  UtilFree(old_sum);
+
+  return match;
+}
+
 //
 // SaveLevel
 //
 void SaveLevel(node_t *root_node)
 {
+  // checksums of the BLOCKMAP and REJECT inputs (empty if unknown)
+  char bmap_sum[32] = "";
+  char reject_sum[32] = "";
+
   lev_force_v3 = (cur_info->spec_version == 3) ? TRUE : FALSE;
   lev_force_v5 = (cur_info->spec_version == 5) ? TRUE : FALSE;
   
@@ -1678,6 +1863,11 @@ void SaveLevel(node_t *root_node)
 
   if (lev_doing_normal)
   {
+    // the GL lumps are done, so partners no longer matter.  With -v1
+    // the segs were already rounded off above, so merging joins the
+    // rounded segs (skipping any that became degenerate).
+    MergeBspTree();
+
     if (cur_info->spec_version != 1)
       RoundOffBspTree(root_node);
  
@@ -1707,11 +1897,24 @@ void SaveLevel(node_t *root_node)
       PutNodes("NODES", FALSE, FALSE, root_node);
     }
 
-    // -JL- Don't touch blockmap and reject if not doing normal nodes
-    PutBlockmap();
+    // -JL- Don't touch blockmap and reject if not doing normal nodes.
+    // They can also be kept when their inputs have not changed since
+    // the previous build.
+    InputChecksum(bmap_sum, FALSE);
+    InputChecksum(reject_sum, TRUE);
 
-    if (!cur_info->no_reject || !FindLevelLump("REJECT"))
+    if (KeepOldLump("BLOCKMAP", "BLOCKMAP_SUM", bmap_sum, -1))
+      PrintVerbose("Kept unchanged blockmap\n");
+    else
+      PutBlockmap();
+
+    if (KeepOldLump("REJECT", "REJECT_SUM", reject_sum,
+                    (num_sectors * num_sectors + 7) / 8))
+      PrintVerbose("Kept unchanged reject lump\n");
+    else if (!cur_info->no_reject || !FindLevelLump("REJECT"))
       PutReject();
+    else
+      reject_sum[0] = 0;  // left alone, unchecked
   }
 
   // keyword support (v5.0 of the specs)
@@ -1727,6 +1930,12 @@ void SaveLevel(node_t *root_node)
     }
   }
 
+  if (bmap_sum[0])
+    AddGLTextLine("BLOCKMAP_SUM", bmap_sum);
+
+  if (reject_sum[0])
+    AddGLTextLine("REJECT_SUM", reject_sum);
+
   // this must be done _after_ the normal nodes have been built,
   // so that we use the new VERTEXES lump in the checksum.
   PutGLChecksum();
@@ -33,10 +33,6 @@ struct superblock_s;
 // a wall_tip is where a wall meets a vertex
 typedef struct wall_tip_s
 {
-  // link in list.  List is kept in ANTI-clockwise order.
-  struct wall_tip_s *next;
-  struct wall_tip_s *prev;
-  
   // angle that line makes at vertex (degrees).
   angle_g angle;
 
@@ -66,14 +62,25 @@ typedef struct vertex_s
   // previous vertex.  Only used during the pruning phase.
   struct vertex_s *equiv;
 
-  // set of wall_tips
+  // set of wall_tips, an array kept in ANTI-clockwise order (i.e.
+  // increasing angle).
   wall_tip_t *tip_set;
+  int num_tips;
+
+  // set when a tip went after one with a slightly larger angle (tips
+  // within ANG_EPSILON keep the order they were added in), so that
+  // the array cannot be binary searched.
+  boolean_g tips_unsorted;
 
   // contains a duplicate vertex, needed when both normal and V2 GL
   // nodes are being built at the same time (this is the vertex used
   // for the normal segs).  Normally NULL.  Note: the wall tips on
   // this vertex are not created.
   struct vertex_s *normal_dup;
+
+  // next split vertex in the same cell of the split table (see
+  // NewVertexFromSplitSeg).
+  struct vertex_s *snap_next;
 }
 vertex_t;
 
@@ -108,18 +115,20 @@ typedef struct sector_s
   int tag;
 
   // used when building REJECT table.  Each set of sectors that are
-  // isolated from other sectors will have a different group number.
-  // Thus: on every 2-sided linedef, the sectors on both sides will be
-  // in the same group.  The rej_next, rej_prev fields are a link in a
-  // RING, containing all sectors of the same group.
+  // isolated from other sectors will have a different group number
+  // (the lowest sector index in the set).  Thus: on every 2-sided
+  // linedef, the sectors on both sides will be in the same group.
   int rej_group;
 
-  struct sector_s *rej_next;
-  struct sector_s *rej_prev;
-
   // suppress superfluous mini warnings
   int warned_facing;
   char warned_unclosed;
+
+  // non-zero if the sector is a single convex polygon with nothing
+  // inside it.  Seg lists holding only segs of this sector (and each
+  // one longer than convex_min_len) cannot be partitioned.
+  char is_convex;
+  float_g convex_min_len;
 }
 sector_t;
 
@@ -191,10 +200,25 @@ typedef struct linedef_s
   int specials[5];
   
   // normally NULL, except when this linedef directly overlaps an earlier
-  // one (a rarely-used trick to create higher mid-masked textures).
+  // one (a rarely-used trick to create higher mid-masked textures), or
+  // lies entirely along other collinear linedefs.
   // No segs should be created for these overlapping linedefs.
   struct linedef_s *overlap;
 
+  // normally NULL, except when only one end of this linedef overlaps
+  // earlier collinear ones.  Segs are then only created for the part
+  // from part_start to part_end (in the same direction as the line).
+  struct vertex_s *part_start;
+  struct vertex_s *part_end;
+
+  // for -strategy boundary: the first linedef of the run of collinear
+  // sector boundaries which this linedef belongs to, otherwise NULL.
+  // The run_len and run_stamp fields of that first linedef are used
+  // when looking for the longest runs in a group of segs.
+  struct linedef_s *run;
+  float_g run_len;
+  int run_stamp;
+
   // linedef index.  Always valid after loading & pruning of zero
   // length lines has occurred.
   int index;
@@ -388,7 +412,7 @@ thing_t *NewThing(void);
 seg_t *NewSeg(void);
 subsec_t *NewSubsec(void);
 node_t *NewNode(void);
-wall_tip_t *NewWallTip(void);
+wall_tip_t *NewWallTips(int count);
 
 // lookup routines
 vertex_t *LookupVertex(int index);
@@ -69,7 +69,19 @@ static superblock_t *quick_alloc_supers = NULL;
 //
 static int PointOnLineSide(seg_t *part, float_g x, float_g y)
 {
-  float_g perp = UtilPerpDist(part, x, y);
+  float_g cross = UtilPerpCross(part, x, y);
+  float_g limit = DIST_EPSILON * part->p_length;
+
+  float_g perp;
+
+  // the division is only needed near the limit
+  if (fabs(cross) > limit * (1.0 + PERP_FILTER_MARGIN))
+    return (cross < 0) ? -1 : +1;
+
+  if (fabs(cross) < limit * (1.0 - PERP_FILTER_MARGIN))
+    return 0;
+
+  perp = cross / part->p_length;
   
   if (fabs(perp) <= DIST_EPSILON)
     return 0;
@@ -383,6 +395,7 @@ superblock_t *CreateSegs(void)
   int bw, bh;
 
   seg_t *left, *right;
+  vertex_t *start, *end;
   superblock_t *block;
 
   PrintVerbose("Creating Segs...\n");
@@ -416,6 +429,10 @@ superblock_t *CreateSegs(void)
     if (line->self_ref && cur_info->skip_self_ref)
       continue;
 
+    // only part of a partly overlapping line gets segs
+    start = line->part_start ? line->part_start : line->start;
+    end   = line->part_end   ? line->part_end   : line->end;
+
     // check for Humungously long lines
     if (ABS(line->start->x - line->end->x) >= 10000 ||
         ABS(line->start->y - line->end->y) >= 10000)
@@ -430,7 +447,7 @@ superblock_t *CreateSegs(void)
     
     if (line->right)
     {
-      right = CreateOneSeg(line, line->start, line->end, line->right, 0);
+      right = CreateOneSeg(line, start, end, line->right, 0);
       AddSegToSuper(block, right);
     }
     else
@@ -438,7 +455,7 @@ superblock_t *CreateSegs(void)
 
     if (line->left)
     {
-      left = CreateOneSeg(line, line->end, line->start, line->left, 1);
+      left = CreateOneSeg(line, end, start, line->left, 1);
       AddSegToSuper(block, left);
       
       if (right)
@@ -465,8 +482,8 @@ superblock_t *CreateSegs(void)
       {
         seg_t *left = NewSeg();
 
-        left->start   = line->end;
-        left->end     = line->start;
+        left->start   = end;
+        left->end     = start;
         left->side    = 1;
         left->linedef = right->linedef;
         left->sector  = line->window_effect;
@@ -1028,6 +1045,105 @@ void ClockwiseBspTree(node_t *root)
   }
 }
 
+//
+// MergeSegPair
+//
+// Checks whether seg B directly follows seg A along the same side of
+// the same linedef, so that they can be joined into one seg.
+//
+static INLINE_G int MergeSegPair(const seg_t *A, const seg_t *B)
+{
+  return (A != B && A->linedef && A->linedef == B->linedef &&
+      A->side == B->side && A->sector == B->sector &&
+      A->end == B->start && ! A->degenerate && ! B->degenerate);
+}
+
+//
+// RemoveMergedSeg
+//
+static void RemoveMergedSeg(seg_t *cur)
+{
+# if DEBUG_SUBSEC
+  PrintDebug("Subsec: Removing merged seg %p\n", cur);
+# endif
+
+  // like a degenerate seg, it will not be written out
+  cur->degenerate = 1;
+  cur->index = 1<<24;
+  cur->next = NULL;
+}
+
+static int MergeSubsector(subsec_t *sub)
+{
+  seg_t *cur, *tail;
+  int count = 0;
+
+# if DEBUG_SUBSEC
+  PrintDebug("Subsec: Merging %d\n", sub->index);
+# endif
+
+  for (cur=sub->seg_list; cur && cur->next; )
+  {
+    seg_t *B = cur->next;
+
+    if (! MergeSegPair(cur, B))
+    {
+      cur = cur->next;
+      continue;
+    }
+
+    cur->end  = B->end;
+    cur->next = B->next;
+    RecomputeSeg(cur);
+
+    RemoveMergedSeg(B);
+    count++;
+  }
+
+  // the last seg may also continue into the first one.  The first seg
+  // is kept (see ClockwiseOrder), so it takes over the start of the
+  // last one.
+
+  for (tail=sub->seg_list; tail && tail->next && tail->next->next; )
+    tail = tail->next;
+
+  if (tail && tail->next && MergeSegPair(tail->next, sub->seg_list))
+  {
+    cur = sub->seg_list;
+
+    cur->start = tail->next->start;
+    RecomputeSeg(cur);
+
+    RemoveMergedSeg(tail->next);
+    tail->next = NULL;
+    count++;
+  }
+
+  return count;
+}
+
+//
+// MergeBspTree
+//
+void MergeBspTree(void)
+{
+  int i;
+  int count = 0;
+
+  DisplayTicker();
+
+  for (i=0; i < num_subsecs; i++)
+    count += MergeSubsector(LookupSubsec(i));
+
+  if (count > 0)
+    PrintVerbose("Merged %d segs in the normal nodes\n", count);
+
+  num_complete_seg = 0;
+
+  for (i=0; i < num_subsecs; i++)
+    RenumberSubsecSegs(LookupSubsec(i));
+}
+
 static void NormaliseSubsector(subsec_t *sub)
 {
   seg_t *new_head = NULL;
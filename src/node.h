@@ -66,6 +66,14 @@ int ComputeBspHeight(node_t *node);
 //
 void ClockwiseBspTree(node_t *root);
 
+// traverse the BSP tree and join consecutive segs in a subsector
+// which lie along the same side of the same linedef.  These are left
+// over from splitting a seg's partner after the seg had already
+// reached its subsector.  Only for the normal nodes: the joined seg
+// has no single partner, so the GL lumps must be written before.
+//
+void MergeBspTree(void);
+
 // traverse the BSP tree and do whatever is necessary to convert the
 // node information from GL standard to normal standard (for example,
 // removing minisegs).
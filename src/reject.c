@@ -41,39 +41,38 @@
 #define DEBUG_REJECT  0
 
 
-//
-// InitReject
-//
-// Puts each sector into individual groups.
-// 
-static void InitReject(void)
-{
-  int i;
+// the sectors of each group, in index order.  Groups are numbered by
+// their lowest sector, and group G has the REJ_GROUP_SIZE(G) sectors
+// at REJ_GROUP_LIST(G).  Other numbers are empty groups.
+static int *rej_group_start;
+static int *rej_members;
 
-  for (i=0; i < num_sectors; i++)
-  {
-    sector_t *sec = LookupSector(i);
+#define REJ_GROUP_SIZE(g)  (rej_group_start[(g)+1] - rej_group_start[g])
+#define REJ_GROUP_LIST(g)  (rej_members + rej_group_start[g])
+
+// the matrix being built, as words (see CreateReject)
+static uint32_g *rej_words;
+static int rej_row_words;
 
-    sec->rej_group = i;
-    sec->rej_next = sec->rej_prev = sec;
-  }
-}
 
 //
 // GroupSectors
 //
-// Algorithm: Initially all sectors are in individual groups.  Now we
+// Algorithm: Initially all sectors are in individual sets.  Now we
 // scan the linedef list.  For each 2-sectored line, merge the two
-// sector groups into one.  That's it !
+// sets into one.  Then each set becomes a group, numbered by its
+// lowest sector.
 //
 static void GroupSectors(void)
 {
+  dset_t *set = DSet_Create(num_sectors);
+  int *lowest;
   int i;
 
   for (i=0; i < num_linedefs; i++)
   {
     linedef_t *line = LookupLinedef(i);
-    sector_t *sec1, *sec2, *tmp;
+    sector_t *sec1, *sec2;
 
     if (! line->right || ! line->left)
       continue;
@@ -89,122 +88,1210 @@ static void GroupSectors(void)
     if (! sec1 || ! sec2 || sec1 == sec2)
       continue;
 
-    // already in the same group ?
-    if (sec1->rej_group == sec2->rej_group)
+    DSet_Union(set, sec1->index, sec2->index);
+  }
+
+  lowest = UtilCalloc(MAX(1, num_sectors) * sizeof(int));
+
+  for (i=0; i < num_sectors; i++)
+    lowest[i] = -1;
+
+  rej_group_start = UtilCalloc((num_sectors + 1) * sizeof(int));
+  rej_members = UtilCalloc(MAX(1, num_sectors) * sizeof(int));
+
+  for (i=0; i < num_sectors; i++)
+  {
+    int root = DSet_Find(set, i);
+
+    if (lowest[root] < 0)
+      lowest[root] = i;
+
+    LookupSector(i)->rej_group = lowest[root];
+
+    rej_group_start[lowest[root] + 1] += 1;
+  }
+
+  for (i=0; i < num_sectors; i++)
+    rej_group_start[i+1] += rej_group_start[i];
+
+  // fill in the member lists, re-using 'lowest' for the positions
+  for (i=0; i < num_sectors; i++)
+    lowest[i] = rej_group_start[i];
+
+  for (i=0; i < num_sectors; i++)
+    rej_members[lowest[LookupSector(i)->rej_group]++] = i;
+
+  UtilFree(lowest);
+  DSet_Free(set);
+}
+
+//
+// FreeGroups
+//
+static void FreeGroups(void)
+{
+  UtilFree(rej_group_start);
+  UtilFree(rej_members);
+
+  rej_group_start = rej_members = NULL;
+}
+
+#if DEBUG_REJECT
+static void CountGroups(void)
+{
+  int g;
+
+  for (g=0; g < num_sectors; g++)
+  {
+    if (REJ_GROUP_SIZE(g) > 0)
+      PrintDebug("Group %d  Sectors %d\n", g, REJ_GROUP_SIZE(g));
+  }
+}
+#endif
+
+
+/* ----- line of sight --------------------------------------------- */
+
+// A portal is a two-sided linedef seen from one of its sides.  The
+// segment is stored so that the sector being entered lies on its
+// left.  Sight lines crossing a chain of portals are found with a
+// flood from each source portal (like the "vis" tools for 3D games):
+// beyond the last portal passed, the next portals can only be seen
+// within the separating lines of the source portal and that last
+// portal.  Everything errs on the safe side: two sectors may be
+// marked as seeing each other when they can't, but never the other
+// way around.
+
+#define REJ_EPSILON  (1.0 / 16.0)
+
+// portals are lengthened at each end by this much, to allow for
+// sight lines grazing a vertex
+#define REJ_WIDEN    1.0
+
+// how many times the boxes of a portal may be enlarged before the
+// whole portal is used instead
+#define REJ_MAX_GROW  8
+
+// limit on flood steps per sector for "-reject normal".  Sectors
+// that reach it simply see their whole group.
+#define REJ_NORMAL_STEPS  20000
+
+// the main worker keeps the display alive and checks for the user
+// cancelling after this many sectors, or flood steps within one.
+#define REJ_TICK_SECTORS  16
+#define REJ_TICK_STEPS    4096
+
+typedef struct rej_portal_s
+{
+  // sector being left, and sector being entered
+  int from, to;
+
+  int line;
+
+  double x1, y1, x2, y2;
+}
+rej_portal_t;
+
+// a piece of a portal, from t1 to t2 along its segment
+typedef struct rej_seg_s
+{
+  const rej_portal_t *P;
+
+  double t1, t2;
+}
+rej_seg_t;
+
+// what the flood from the current source portal has already done
+// with each portal: a few boxes, each covering a piece of the source
+// (s1..s2) and a piece of this portal (t1..t2) that were flooded.
+#define REJ_MEMO_BOXES  4
+
+typedef struct rej_memo_s
+{
+  int stamp;
+  int grow;
+  int num_boxes;
+
+  struct
+  {
+    double s1, s2;
+    double t1, t2;
+  }
+  box[REJ_MEMO_BOXES];
+}
+rej_memo_t;
+
+// a step of the flood: the source piece, the piece of the portal it
+// passed through, and the next portal to try leaving that sector.
+// The flood keeps these on its own stack rather than recursing, since
+// a sight line can pass through thousands of sectors.
+typedef struct rej_frame_s
+{
+  rej_seg_t src;
+  rej_seg_t pass;
+
+  int k;
+}
+rej_frame_t;
+
+typedef struct rej_worker_s
+{
+  // sectors done by this worker: first, first + step, ...
+  int first, step;
+
+  rej_memo_t *memo;
+  int stamp;
+
+  int steps;
+  boolean_g gave_up;
+  int num_gave_up;
+
+  // sectors seen so far, and how many there are in the group.  The
+  // flood can stop once they are all seen.
+  int seen, group_size;
+
+  // visibility row being filled
+  uint8_g *row;
+
+  // stack of flood steps
+  rej_frame_t *stack;
+  int stack_size;
+
+  // flood steps since the last tick (main worker only)
+  int ticks;
+}
+rej_worker_t;
+
+// set when building was cancelled, so all the workers stop
+static volatile boolean_g rej_cancelled;
+
+static rej_portal_t *rej_portals;
+static int rej_num_portals;
+
+// portals leaving each sector (indices into rej_portals)
+static int *rej_sec_start;
+static int *rej_sec_list;
+
+// visibility bits, one row per sector.  Rows are padded to whole
+// bytes so that workers never share one.
+static uint8_g *rej_vis;
+static int rej_vis_stride;
+
+#define REJ_VIS_ROW(sec)  (rej_vis + (sec) * rej_vis_stride)
+
+#define REJ_CAN_SEE(view, target)  \
+    (REJ_VIS_ROW(view)[(target) >> 3] & (1 << ((target) & 7)))
+
+
+//
+// CreatePortals
+//
+static void CreatePortals(void)
+{
+  int i, k;
+  int *fill;
+
+  rej_portals = UtilCalloc(MAX(1, num_linedefs * 2) * sizeof(rej_portal_t));
+  rej_num_portals = 0;
+
+  for (i=0; i < num_linedefs; i++)
+  {
+    linedef_t *line = LookupLinedef(i);
+    rej_portal_t *P;
+    sector_t *sec1, *sec2;
+
+    double dx, dy, len;
+
+    // same test as GroupSectors()
+    if (! line->right || ! line->left || ! line->two_sided)
+      continue;
+
+    sec1 = line->right->sector;
+    sec2 = line->left->sector;
+    
+    if (! sec1 || ! sec2 || sec1 == sec2 || line->zero_len)
       continue;
 
-    // swap sectors so that the smallest group is added to the biggest
-    // group.  This is based on the assumption that sector numbers in
-    // wads will generally increase over the set of linedefs, and so
-    // (by swapping) we'll tend to add small groups into larger
-    // groups, thereby minimising the updates to 'rej_group' fields
-    // that is required when merging.
+    dx = line->end->x - line->start->x;
+    dy = line->end->y - line->start->y;
+    len = sqrt(dx * dx + dy * dy);
+
+    dx = dx * REJ_WIDEN / len;
+    dy = dy * REJ_WIDEN / len;
+
+    // entering the back sector, which lies on the left
+    P = &rej_portals[rej_num_portals++];
+
+    P->from = sec1->index;
+    P->to   = sec2->index;
+    P->line = i;
+
+    P->x1 = line->start->x - dx;  P->y1 = line->start->y - dy;
+    P->x2 = line->end->x   + dx;  P->y2 = line->end->y   + dy;
+
+    // entering the front sector
+    P[1].from = P->to;
+    P[1].to   = P->from;
+    P[1].line = i;
+
+    P[1].x1 = P->x2;  P[1].y1 = P->y2;
+    P[1].x2 = P->x1;  P[1].y2 = P->y1;
 
-    if (sec1->rej_group > sec2->rej_group)
+    rej_num_portals++;
+  }
+
+  rej_sec_start = UtilCalloc((num_sectors + 1) * sizeof(int));
+  rej_sec_list  = UtilCalloc(MAX(1, rej_num_portals) * sizeof(int));
+
+  for (k=0; k < rej_num_portals; k++)
+    rej_sec_start[rej_portals[k].from + 1] += 1;
+
+  for (i=0; i < num_sectors; i++)
+    rej_sec_start[i+1] += rej_sec_start[i];
+
+  fill = UtilCalloc(MAX(1, num_sectors) * sizeof(int));
+
+  for (k=0; k < rej_num_portals; k++)
+  {
+    int from = rej_portals[k].from;
+
+    rej_sec_list[rej_sec_start[from] + fill[from]++] = k;
+  }
+
+  UtilFree(fill);
+}
+
+//
+// FreePortals
+//
+static void FreePortals(void)
+{
+  UtilFree(rej_portals);
+  UtilFree(rej_sec_start);
+  UtilFree(rej_sec_list);
+
+  rej_portals = NULL;
+  rej_sec_start = rej_sec_list = NULL;
+}
+
+//
+// RejSide
+//
+// Returns the distance of point (x,y) from the line through (x1,y1)
+// and (x2,y2), positive on its left side.  The points must differ.
+//
+static double RejSide(double x1, double y1, double x2, double y2,
+    double x, double y)
+{
+  double dx = x2 - x1;
+  double dy = y2 - y1;
+
+  return (dx * (y - y1) - dy * (x - x1)) / sqrt(dx * dx + dy * dy);
+}
+
+static void RejSegPoint(const rej_seg_t *S, double t, double *x, double *y)
+{
+  *x = S->P->x1 + (S->P->x2 - S->P->x1) * t;
+  *y = S->P->y1 + (S->P->y2 - S->P->y1) * t;
+}
+
+//
+// RejClipSide
+//
+// Clips the piece to one side (left when 'keep_left' is true) of the
+// line through (x1,y1) and (x2,y2), keeping what is close to the line
+// too.  Returns false when nothing is left.
+//
+static int RejClipSide(rej_seg_t *S, double x1, double y1,
+    double x2, double y2, int keep_left)
+{
+  double px1, py1, px2, py2;
+  double d1, d2, frac;
+
+  RejSegPoint(S, S->t1, &px1, &py1);
+  RejSegPoint(S, S->t2, &px2, &py2);
+
+  d1 = RejSide(x1, y1, x2, y2, px1, py1);
+  d2 = RejSide(x1, y1, x2, y2, px2, py2);
+
+  if (! keep_left)
+  {
+    d1 = -d1; d2 = -d2;
+  }
+
+  if (d1 < -REJ_EPSILON && d2 < -REJ_EPSILON)
+    return FALSE;
+
+  if (d1 >= -REJ_EPSILON && d2 >= -REJ_EPSILON)
+    return TRUE;
+
+  frac = (-REJ_EPSILON - d1) / (d2 - d1);
+
+  if (d1 < -REJ_EPSILON)
+    S->t1 = S->t1 + (S->t2 - S->t1) * frac;
+  else
+    S->t2 = S->t1 + (S->t2 - S->t1) * frac;
+
+  return TRUE;
+}
+
+//
+// RejClipSeparators
+//
+// Clips the target piece T to the area that can be seen from the
+// source piece S through the pass piece P.  That area is bounded by
+// the lines through an end of S and an end of P which have the rest
+// of S on one side and the rest of P on the other.  Returns false
+// when nothing is left.
+//
+static int RejClipSeparators(rej_seg_t *T, const rej_seg_t *S,
+    const rej_seg_t *P)
+{
+  double sx[2], sy[2];
+  double px[2], py[2];
+
+  int i, j;
+
+  RejSegPoint(S, S->t1, &sx[0], &sy[0]);
+  RejSegPoint(S, S->t2, &sx[1], &sy[1]);
+  RejSegPoint(P, P->t1, &px[0], &py[0]);
+  RejSegPoint(P, P->t2, &px[1], &py[1]);
+
+  for (i=0; i < 2; i++)
+  for (j=0; j < 2; j++)
+  {
+    double ds, dp;
+
+    if (fabs(px[j] - sx[i]) + fabs(py[j] - sy[i]) < REJ_EPSILON)
+      continue;
+
+    ds = RejSide(sx[i], sy[i], px[j], py[j], sx[1-i], sy[1-i]);
+    dp = RejSide(sx[i], sy[i], px[j], py[j], px[1-j], py[1-j]);
+
+    // strict tests are enough here, the clipping itself is lenient
+    if (ds < 0 && dp > 0)
     {
-      tmp = sec1; sec1 = sec2; sec2 = tmp;
+      if (! RejClipSide(T, sx[i], sy[i], px[j], py[j], TRUE))
+        return FALSE;
     }
-    
-    // update the group numbers in the second group
-    
-    sec2->rej_group = sec1->rej_group;
+    else if (ds > 0 && dp < 0)
+    {
+      if (! RejClipSide(T, sx[i], sy[i], px[j], py[j], FALSE))
+        return FALSE;
+    }
+  }
 
-    for (tmp=sec2->rej_next; tmp != sec2; tmp=tmp->rej_next)
-      tmp->rej_group = sec1->rej_group;
-    
-    // merge 'em baby...
+  return TRUE;
+}
+
+//
+// RejMemo
+//
+// Returns false when the flood already went through this portal with
+// a piece covering T, seen from a piece of the source covering S.
+// Otherwise the pieces are remembered and true is returned.  When
+// all the boxes are in use, S and T are enlarged to cover the box
+// that grows the least (bigger pieces can only see more).
+//
+static int RejMemo(rej_worker_t *W, rej_seg_t *S, rej_seg_t *T)
+{
+  rej_memo_t *M = &W->memo[T->P - rej_portals];
+
+  int i, best = 0;
+  double best_area = 1e30;
+
+  if (M->stamp != W->stamp)
+  {
+    M->stamp = W->stamp;
+    M->grow  = 0;
+    M->num_boxes = 0;
+  }
+
+  for (i=0; i < M->num_boxes; i++)
+  {
+    double s1 = M->box[i].s1, s2 = M->box[i].s2;
+    double t1 = M->box[i].t1, t2 = M->box[i].t2;
+
+    double area;
+
+    if (s1 <= S->t1 && S->t2 <= s2 && t1 <= T->t1 && T->t2 <= t2)
+      return FALSE;
 
-    sec1->rej_next->rej_prev = sec2;
-    sec2->rej_next->rej_prev = sec1;
+    area = (MAX(s2, S->t2) - MIN(s1, S->t1)) *
+           (MAX(t2, T->t2) - MIN(t1, T->t1));
 
-    tmp = sec1->rej_next; 
-    sec1->rej_next = sec2->rej_next;
-    sec2->rej_next = tmp;
+    if (area < best_area)
+    {
+      best = i;
+      best_area = area;
+    }
+  }
+
+  if (M->num_boxes < REJ_MEMO_BOXES)
+  {
+    best = M->num_boxes++;
+  }
+  else if (++M->grow >= REJ_MAX_GROW)
+  {
+    S->t1 = T->t1 = 0.0;
+    S->t2 = T->t2 = 1.0;
+  }
+  else
+  {
+    S->t1 = MIN(S->t1, M->box[best].s1);
+    S->t2 = MAX(S->t2, M->box[best].s2);
+    T->t1 = MIN(T->t1, M->box[best].t1);
+    T->t2 = MAX(T->t2, M->box[best].t2);
   }
+
+  M->box[best].s1 = S->t1;  M->box[best].s2 = S->t2;
+  M->box[best].t1 = T->t1;  M->box[best].t2 = T->t2;
+
+  return TRUE;
 }
 
-#if DEBUG_REJECT
-static void CountGroups(void)
+//
+// RejPushFrame
+//
+static void RejPushFrame(rej_worker_t *W, int *depth,
+    const rej_seg_t *src, const rej_seg_t *pass)
+{
+  rej_frame_t *F;
+
+  if (*depth >= W->stack_size)
+  {
+    W->stack_size = W->stack_size ? W->stack_size * 2 : 256;
+    W->stack = UtilRealloc(W->stack, W->stack_size * sizeof(rej_frame_t));
+  }
+
+  F = &W->stack[(*depth)++];
+
+  F->src  = *src;
+  F->pass = *pass;
+  F->k    = -1;
+}
+
+//
+// RejTick
+//
+// Called by the main worker every so often, to keep the display
+// alive and tell the other workers when the user has cancelled.
+//
+static void RejTick(void)
+{
+  DisplayTicker();
+
+  if (cur_comms->cancelled)
+    rej_cancelled = TRUE;
+}
+
+//
+// RejFlood
+//
+// Floods from the source portal piece.  The sector behind each pass
+// piece can be seen from the source, and the flood continues through
+// the portals leaving that sector.  On the first step the pass piece
+// is the source itself.
+//
+static void RejFlood(rej_worker_t *W, const rej_seg_t *start)
+{
+  int depth = 0;
+
+  RejPushFrame(W, &depth, start, start);
+
+  while (depth > 0)
+  {
+    rej_frame_t *F = &W->stack[depth-1];
+
+    const rej_portal_t *PP = F->pass.P;
+    const rej_portal_t *SP = F->src.P;
+
+    int sector = PP->to;
+
+    rej_seg_t S, T;
+
+    if (F->k < 0)
+    {
+      // first visit of this step
+      if (! (W->row[sector >> 3] & (1 << (sector & 7))))
+      {
+        W->row[sector >> 3] |= (1 << (sector & 7));
+        W->seen++;
+      }
+
+      if (W->seen == W->group_size)
+        return;
+
+      if (W->first == 0 && ++W->ticks >= REJ_TICK_STEPS)
+      {
+        W->ticks = 0;
+        RejTick();
+      }
+
+      if (rej_cancelled)
+        return;
+
+      if (cur_info->reject_level == REJECT_NORMAL &&
+          ++W->steps > REJ_NORMAL_STEPS)
+      {
+        W->gave_up = TRUE;
+        return;
+      }
+
+      F->k = rej_sec_start[sector];
+    }
+
+    if (F->k >= rej_sec_start[sector+1])
+    {
+      depth--;
+      continue;
+    }
+
+    S = F->src;
+
+    T.P = &rej_portals[rej_sec_list[F->k++]];
+    T.t1 = 0.0;
+    T.t2 = 1.0;
+
+    if (T.P->line == PP->line)
+      continue;
+
+    // must be beyond the pass portal
+    if (! RejClipSide(&T, PP->x1, PP->y1, PP->x2, PP->y2, TRUE))
+      continue;
+
+    if (depth > 1)
+    {
+      if (! RejClipSide(&T, SP->x1, SP->y1, SP->x2, SP->y2, TRUE))
+        continue;
+
+      if (! RejClipSeparators(&T, &F->src, &F->pass))
+        continue;
+
+      // also narrow the source to what can see the target
+      if (cur_info->reject_level == REJECT_FULL &&
+          ! RejClipSeparators(&S, &T, &F->pass))
+        continue;
+    }
+
+    if (! RejMemo(W, &S, &T))
+      continue;
+
+    // note: this may move the stack, so F is not used after it
+    RejPushFrame(W, &depth, &S, &T);
+  }
+}
+
+//
+// RejectWorker
+//
+// Fills the visibility rows of some sectors.  May run on a thread.
+//
+static void RejectWorker(void *data)
+{
+  rej_worker_t *W = (rej_worker_t *) data;
+  int sec, k, i;
+
+  for (sec=W->first; sec < num_sectors; sec += W->step)
+  {
+    if (W->first == 0 && (sec / W->step) % REJ_TICK_SECTORS == 0)
+      RejTick();
+
+    if (rej_cancelled)
+      return;
+
+    W->row = REJ_VIS_ROW(sec);
+    W->row[sec >> 3] |= (1 << (sec & 7));
+
+    W->steps = 0;
+    W->gave_up = FALSE;
+
+    W->seen = 1;
+    W->group_size = REJ_GROUP_SIZE(LookupSector(sec)->rej_group);
+
+    for (k=rej_sec_start[sec]; k < rej_sec_start[sec+1] && ! W->gave_up &&
+         W->seen < W->group_size; k++)
+    {
+      rej_seg_t S;
+
+      S.P = &rej_portals[rej_sec_list[k]];
+      S.t1 = 0.0;
+      S.t2 = 1.0;
+
+      W->stamp++;
+
+      RejFlood(W, &S);
+    }
+
+    if (W->gave_up)
+    {
+      int group = LookupSector(sec)->rej_group;
+      const int *list = REJ_GROUP_LIST(group);
+
+      for (i=0; i < REJ_GROUP_SIZE(group); i++)
+        W->row[list[i] >> 3] |= (1 << (list[i] & 7));
+
+      W->num_gave_up++;
+    }
+  }
+}
+
+//
+// ComputeSight
+//
+// Works out which sectors can see each other (into rej_vis), with the
+// sectors shared out between the worker threads.  Returns the number
+// of sectors that gave up and use their whole group instead.
+//
+static int ComputeSight(void)
+{
+  int num_workers = MAX(1, MIN(ThreadCount(), num_sectors));
+  int w, gave_up = 0;
+
+  rej_worker_t *workers;
+  thread_t **threads;
+
+  CreatePortals();
+
+  rej_vis_stride = (num_sectors + 7) / 8;
+  rej_vis = UtilCalloc(MAX(1, num_sectors * rej_vis_stride));
+
+  workers = UtilCalloc(num_workers * sizeof(rej_worker_t));
+  threads = UtilCalloc(num_workers * sizeof(thread_t *));
+
+  rej_cancelled = FALSE;
+
+  for (w=0; w < num_workers; w++)
+  {
+    workers[w].first = w;
+    workers[w].step  = num_workers;
+    workers[w].memo  = UtilCalloc(MAX(1, rej_num_portals) * sizeof(rej_memo_t));
+  }
+
+  for (w=1; w < num_workers; w++)
+    threads[w] = ThreadStart(RejectWorker, &workers[w]);
+
+  RejectWorker(&workers[0]);
+
+  for (w=0; w < num_workers; w++)
+  {
+    if (w > 0)
+      ThreadJoin(threads[w]);
+
+    gave_up += workers[w].num_gave_up;
+
+    UtilFree(workers[w].memo);
+
+    if (workers[w].stack)
+      UtilFree(workers[w].stack);
+  }
+
+  UtilFree(workers);
+  UtilFree(threads);
+
+  FreePortals();
+
+  return gave_up;
+}
+
+//
+// SymmetricSight
+//
+// Sight goes both ways, so make each sector see the sectors which
+// can see it.  Only pairs in the same group need checking.
+//
+static void SymmetricSight(void)
+{
+  int g, i, j;
+
+  for (g=0; g < num_sectors; g++)
+  {
+    const int *list = REJ_GROUP_LIST(g);
+
+    for (i=0; i < REJ_GROUP_SIZE(g); i++)
+    for (j=0; j < i; j++)
+    {
+      int v = list[i];
+      int t = list[j];
+
+      if (REJ_CAN_SEE(v, t) || REJ_CAN_SEE(t, v))
+      {
+        REJ_VIS_ROW(v)[t >> 3] |= (1 << (t & 7));
+        REJ_VIS_ROW(t)[v >> 3] |= (1 << (v & 7));
+      }
+    }
+  }
+}
+
+
+/* ----- distance limit ------------------------------------------- */
+
+// With -rejectdist, sectors whose bounding boxes are further apart
+// than the given distance cannot see each other.  The boxes are put
+// into a grid, so that each sector only looks at the cells near it.
+
+// grid cells are at least this big, and there are at most this many
+#define REJ_MIN_CELL   128
+#define REJ_MAX_CELLS  (1 << 20)
+
+typedef struct rej_box_s
+{
+  // x1 > x2 when the sector has no lines
+  int x1, y1, x2, y2;
+}
+rej_box_t;
+
+static rej_box_t *rej_boxes;
+
+static int rej_grid_x, rej_grid_y;
+static int rej_grid_w, rej_grid_h;
+static int rej_cell_size;
+
+// the sectors whose box touches each cell
+static int *rej_cell_start;
+static int *rej_cell_list;
+
+
+static void RejBoxAdd(rej_box_t *box, float_g x, float_g y)
+{
+  box->x1 = MIN(box->x1, (int) floor(x));
+  box->y1 = MIN(box->y1, (int) floor(y));
+  box->x2 = MAX(box->x2, (int) ceil(x));
+  box->y2 = MAX(box->y2, (int) ceil(y));
+}
+
+//
+// CreateSectorBoxes
+//
+static void CreateSectorBoxes(void)
 {
-  // Note: this routine is destructive to the group numbers
-  
   int i;
 
+  rej_boxes = UtilCalloc(MAX(1, num_sectors) * sizeof(rej_box_t));
+
   for (i=0; i < num_sectors; i++)
   {
-    sector_t *sec = LookupSector(i);
-    sector_t *tmp;
+    rej_boxes[i].x1 = rej_boxes[i].y1 = INT_MAX;
+    rej_boxes[i].x2 = rej_boxes[i].y2 = INT_MIN;
+  }
+
+  for (i=0; i < num_linedefs; i++)
+  {
+    linedef_t *line = LookupLinedef(i);
+    sidedef_t *sides[2];
+    int k;
+
+    sides[0] = line->right;
+    sides[1] = line->left;
 
-    int group = sec->rej_group;
-    int num = 0;
+    for (k=0; k < 2; k++)
+    {
+      rej_box_t *box;
+
+      if (! sides[k] || ! sides[k]->sector)
+        continue;
+
+      box = &rej_boxes[sides[k]->sector->index];
+
+      RejBoxAdd(box, line->start->x, line->start->y);
+      RejBoxAdd(box, line->end->x,   line->end->y);
+    }
+  }
+}
+
+//
+// CreateDistGrid
+//
+// Puts each sector into every grid cell that its box touches.  Done
+// in two passes, counting and then filling.
+//
+static void CreateDistGrid(void)
+{
+  int x1 = INT_MAX, y1 = INT_MAX;
+  int x2 = INT_MIN, y2 = INT_MIN;
 
-    if (group < 0)
+  int pass, i, cx, cy;
+  int *fill = NULL;
+
+  for (i=0; i < num_sectors; i++)
+  {
+    if (rej_boxes[i].x1 > rej_boxes[i].x2)
       continue;
 
-    sec->rej_group = -1;
-    num++;
+    x1 = MIN(x1, rej_boxes[i].x1);  y1 = MIN(y1, rej_boxes[i].y1);
+    x2 = MAX(x2, rej_boxes[i].x2);  y2 = MAX(y2, rej_boxes[i].y2);
+  }
 
-    for (tmp=sec->rej_next; tmp != sec; tmp=tmp->rej_next)
+  if (x1 > x2)
+  {
+    x1 = y1 = x2 = y2 = 0;
+  }
+
+  rej_grid_x = x1;
+  rej_grid_y = y1;
+
+  rej_cell_size = MAX(cur_info->reject_dist, REJ_MIN_CELL);
+
+  for (;;)
+  {
+    rej_grid_w = (x2 - x1) / rej_cell_size + 1;
+    rej_grid_h = (y2 - y1) / rej_cell_size + 1;
+
+    if ((double) rej_grid_w * rej_grid_h <= REJ_MAX_CELLS)
+      break;
+
+    rej_cell_size *= 2;
+  }
+
+  rej_cell_start = UtilCalloc((rej_grid_w * rej_grid_h + 1) * sizeof(int));
+
+  for (pass=0; pass < 2; pass++)
+  {
+    if (pass == 1)
     {
-      tmp->rej_group = -1;
-      num++;
+      for (i=0; i < rej_grid_w * rej_grid_h; i++)
+        rej_cell_start[i+1] += rej_cell_start[i];
+
+      rej_cell_list = UtilCalloc(MAX(1, rej_cell_start[i]) * sizeof(int));
+
+      fill = UtilCalloc(rej_grid_w * rej_grid_h * sizeof(int));
     }
 
-    PrintDebug("Group %d  Sectors %d\n", group, num);
+    for (i=0; i < num_sectors; i++)
+    {
+      const rej_box_t *box = &rej_boxes[i];
+
+      if (box->x1 > box->x2)
+        continue;
+
+      for (cy=(box->y1 - y1) / rej_cell_size; cy <= (box->y2 - y1) / rej_cell_size; cy++)
+      for (cx=(box->x1 - x1) / rej_cell_size; cx <= (box->x2 - x1) / rej_cell_size; cx++)
+      {
+        int cell = cy * rej_grid_w + cx;
+
+        if (pass == 0)
+          rej_cell_start[cell + 1] += 1;
+        else
+          rej_cell_list[rej_cell_start[cell] + fill[cell]++] = i;
+      }
+    }
   }
+
+  UtilFree(fill);
 }
-#endif
 
 //
-// CreateReject
+// FreeDistGrid
+//
+static void FreeDistGrid(void)
+{
+  UtilFree(rej_boxes);
+  UtilFree(rej_cell_start);
+  UtilFree(rej_cell_list);
+
+  rej_boxes = NULL;
+  rej_cell_start = rej_cell_list = NULL;
+}
+
 //
-static void CreateReject(uint8_g *matrix)
+// NearSectors
+//
+// Sets the bits in 'near' for every sector whose box is within the
+// -rejectdist distance of the box of 'view'.
+//
+static void NearSectors(uint32_g *near, int view)
 {
-  int view, target;
+  const rej_box_t *A = &rej_boxes[view];
+
+  double dist = cur_info->reject_dist;
+  int cx1, cy1, cx2, cy2;
+  int cx, cy, k;
+
+  memset(near, 0, rej_row_words * sizeof(uint32_g));
 
-  for (view=0; view < num_sectors; view++)
-  for (target=0; target < view; target++)
+  // a sector can always see itself
+  near[view >> 5] |= (1U << (view & 31));
+
+  if (A->x1 > A->x2)
+    return;
+
+  cx1 = MAX(0, (int) floor((A->x1 - dist - rej_grid_x) / rej_cell_size));
+  cy1 = MAX(0, (int) floor((A->y1 - dist - rej_grid_y) / rej_cell_size));
+  cx2 = MIN(rej_grid_w - 1, (int) floor((A->x2 + dist - rej_grid_x) / rej_cell_size));
+  cy2 = MIN(rej_grid_h - 1, (int) floor((A->y2 + dist - rej_grid_y) / rej_cell_size));
+
+  for (cy=cy1; cy <= cy2; cy++)
+  for (cx=cx1; cx <= cx2; cx++)
   {
-    sector_t *view_sec = LookupSector(view);
-    sector_t *targ_sec = LookupSector(target);
+    int cell = cy * rej_grid_w + cx;
+
+    for (k=rej_cell_start[cell]; k < rej_cell_start[cell+1]; k++)
+    {
+      int other = rej_cell_list[k];
+      const rej_box_t *B = &rej_boxes[other];
+
+      double dx, dy;
+
+      if (near[other >> 5] & (1U << (other & 31)))
+        continue;
+
+      dx = MAX(0, MAX(B->x1 - A->x2, A->x1 - B->x2));
+      dy = MAX(0, MAX(B->y1 - A->y2, A->y1 - B->y2));
+
+      if (dx * dx + dy * dy <= dist * dist)
+        near[other >> 5] |= (1U << (other & 31));
+    }
+  }
+}
+
+
+/* ----- filling the matrix ---------------------------------------- */
+
+// The matrix is built as 32-bit words (bit N of the lump is bit N&31
+// of word N>>5) and each row is done a word at a time.  The row of a
+// sector is the inverse of the set of sectors it can see: its whole
+// group, or its row of rej_vis.  Rows are handed out in runs of 32,
+// since such a run always begins on a word boundary, so that no two
+// workers touch the same word.
 
-    int p1, p2;
+#define REJ_ROW_RUN  32
 
-    if (view_sec->rej_group == targ_sec->rej_group)
+// groups at least this big get a bitset of their members, smaller
+// groups use their member list.
+#define REJ_BIG_GROUP  32
+
+typedef struct rej_fill_s
+{
+  // runs done by this worker: first, first + step, ...
+  int first, step;
+
+  // sectors seen from the current row
+  uint32_g *see;
+
+  // sectors near enough to it (only for -rejectdist)
+  uint32_g *near;
+}
+rej_fill_t;
+
+// membership bitsets, indexed by group (NULL for small groups)
+static uint32_g **rej_group_bits;
+
+
+//
+// CreateGroupBits
+//
+static void CreateGroupBits(void)
+{
+  int g, i;
+
+  rej_group_bits = UtilCalloc(MAX(1, num_sectors) * sizeof(uint32_g *));
+
+  for (g=0; g < num_sectors; g++)
+  {
+    const int *list = REJ_GROUP_LIST(g);
+
+    if (REJ_GROUP_SIZE(g) < REJ_BIG_GROUP)
       continue;
 
-    // for symmetry, do two bits at a time
+    rej_group_bits[g] = UtilCalloc(rej_row_words * sizeof(uint32_g));
 
-    p1 = view * num_sectors + target;
-    p2 = target * num_sectors + view;
-    
-    matrix[p1 >> 3] |= (1 << (p1 & 7));
-    matrix[p2 >> 3] |= (1 << (p2 & 7));
+    for (i=0; i < REJ_GROUP_SIZE(g); i++)
+      rej_group_bits[g][list[i] >> 5] |= (1U << (list[i] & 31));
+  }
+}
+
+//
+// FreeGroupBits
+//
+static void FreeGroupBits(void)
+{
+  int g;
+
+  for (g=0; g < num_sectors; g++)
+    if (rej_group_bits[g])
+      UtilFree(rej_group_bits[g]);
+
+  UtilFree(rej_group_bits);
+  rej_group_bits = NULL;
+}
+
+//
+// FillRow
+//
+// Sets the bits in the row of 'view' for every sector not in 'see'.
+//
+static void FillRow(int view, const uint32_g *see)
+{
+  int bit = view * num_sectors;
+  int shift = bit & 31;
+  int i;
+
+  uint32_g *dest = rej_words + (bit >> 5);
+
+  for (i=0; i < rej_row_words; i++)
+  {
+    uint32_g w = ~see[i];
+
+    if (i == rej_row_words - 1 && (num_sectors & 31))
+      w &= (1U << (num_sectors & 31)) - 1;
+
+    dest[i] |= w << shift;
+
+    // the test keeps us from touching words beyond the row
+    if (shift > 0 && (w >> (32 - shift)))
+      dest[i+1] |= w >> (32 - shift);
+  }
+}
+
+//
+// RejectFillWorker
+//
+// Fills the rows of some runs of sectors.  May run on a thread.
+//
+static void RejectFillWorker(void *data)
+{
+  rej_fill_t *F = (rej_fill_t *) data;
+  int run, view, i;
+
+  for (run=F->first; run * REJ_ROW_RUN < num_sectors; run += F->step)
+  {
+    int last = MIN(num_sectors, (run + 1) * REJ_ROW_RUN);
+
+    for (view=run * REJ_ROW_RUN; view < last; view++)
+    {
+      sector_t *sec = LookupSector(view);
+      const uint32_g *see = F->see;
+
+      if (rej_vis)
+      {
+        const uint8_g *row = REJ_VIS_ROW(view);
+
+        memset(F->see, 0, rej_row_words * sizeof(uint32_g));
+
+        for (i=0; i < rej_vis_stride; i++)
+          F->see[i >> 2] |= (uint32_g) row[i] << ((i & 3) * 8);
+      }
+      else if (rej_group_bits[sec->rej_group])
+      {
+        see = rej_group_bits[sec->rej_group];
+      }
+      else
+      {
+        const int *list = REJ_GROUP_LIST(sec->rej_group);
+
+        memset(F->see, 0, rej_row_words * sizeof(uint32_g));
+
+        for (i=0; i < REJ_GROUP_SIZE(sec->rej_group); i++)
+          F->see[list[i] >> 5] |= (1U << (list[i] & 31));
+      }
+
+      if (rej_boxes)
+      {
+        NearSectors(F->near, view);
+
+        for (i=0; i < rej_row_words; i++)
+          F->near[i] &= see[i];
+
+        see = F->near;
+      }
+
+      FillRow(view, see);
+    }
+  }
+}
+
+//
+// CreateReject
+//
+// Builds the matrix into rej_words, with the rows shared out between
+// the worker threads.
+//
+static void CreateReject(void)
+{
+  int num_runs = (num_sectors + REJ_ROW_RUN - 1) / REJ_ROW_RUN;
+  int num_workers = MAX(1, MIN(ThreadCount(), num_runs));
+  int w;
+
+  rej_fill_t *fills;
+  thread_t **threads;
+
+  rej_row_words = (num_sectors + 31) / 32;
+
+  if (! rej_vis)
+    CreateGroupBits();
+
+  if (cur_info->reject_dist > 0)
+  {
+    CreateSectorBoxes();
+    CreateDistGrid();
+  }
+
+  fills   = UtilCalloc(num_workers * sizeof(rej_fill_t));
+  threads = UtilCalloc(num_workers * sizeof(thread_t *));
+
+  for (w=0; w < num_workers; w++)
+  {
+    fills[w].first = w;
+    fills[w].step  = num_workers;
+    fills[w].see   = UtilCalloc(MAX(1, rej_row_words) * sizeof(uint32_g));
+    fills[w].near  = UtilCalloc(MAX(1, rej_row_words) * sizeof(uint32_g));
   }
+
+  for (w=1; w < num_workers; w++)
+    threads[w] = ThreadStart(RejectFillWorker, &fills[w]);
+
+  RejectFillWorker(&fills[0]);
+
+  for (w=0; w < num_workers; w++)
+  {
+    if (w > 0)
+      ThreadJoin(threads[w]);
+
+    UtilFree(fills[w].see);
+    UtilFree(fills[w].near);
+  }
+
+  UtilFree(fills);
+  UtilFree(threads);
+
+  if (! rej_vis)
+    FreeGroupBits();
+
+  if (rej_boxes)
+    FreeDistGrid();
 }
 
 //
 // PutReject
 //
-// For now we only do very basic reject processing, limited to
-// determining all isolated groups of sectors (islands that are
-// surrounded by void space).
+// With "-reject fast" we only do very basic reject processing,
+// limited to determining all isolated groups of sectors (islands
+// that are surrounded by void space).  The other levels also check
+// the lines of sight between sectors of the same group.
 //
 void PutReject(void)
 {
   int reject_size;
-  uint8_g *matrix;
+  int gave_up = 0;
   lump_t *lump;
 
   DisplayTicker();
 
-  InitReject();
   GroupSectors();
+
+  if (cur_info->reject_level != REJECT_FAST)
+  {
+    gave_up = ComputeSight();
+    SymmetricSight();
+  }
   
   reject_size = (num_sectors * num_sectors + 7) / 8;
-  matrix = UtilCalloc(reject_size);
+  rej_words = UtilCalloc(MAX(1, (num_sectors * num_sectors + 31) / 32) * 4);
+
+  CreateReject();
 
-  CreateReject(matrix);
+  // the words become the bytes of the lump
+  Endian_Array32(rej_words, (num_sectors * num_sectors + 31) / 32);
 
 # if DEBUG_REJECT
   CountGroups();
@@ -212,10 +1299,23 @@ void PutReject(void)
 
   lump = CreateLevelLump("REJECT");
 
-  AppendLevelLump(lump, matrix, reject_size);
+  AppendLevelLump(lump, rej_words, reject_size);
 
-  PrintVerbose("Added simple reject lump\n");
+  if (cur_info->reject_level == REJECT_FAST)
+    PrintVerbose("Added simple reject lump\n");
+  else if (gave_up > 0)
+    PrintVerbose("Added reject lump (%d sectors too complex)\n", gave_up);
+  else
+    PrintVerbose("Added reject lump\n");
 
-  UtilFree(matrix);
-}
+  if (rej_vis)
+  {
+    UtilFree(rej_vis);
+    rej_vis = NULL;
+  }
+
+  UtilFree(rej_words);
+  rej_words = NULL;
 
+  FreeGroups();
+}
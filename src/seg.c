@@ -60,6 +60,11 @@
 
 #define SEG_FAST_THRESHHOLD  200
 
+// -strategy boundary: groups with at least this many real segs are
+// split along a boundary run, trying only the longest few runs.
+#define SEG_COARSE_THRESHHOLD  200
+#define COARSE_CANDIDATES  32
+
 
 #define DEBUG_PICKNODE  0
 #define DEBUG_SPLIT     0
@@ -284,11 +289,18 @@ static void AddIntersection(intersection_t ** cut_list,
   intersection_t *cut;
   intersection_t *after;
 
-  /* check if vertex already present */
+  /* check if vertex already present.  A split vertex may have been
+   * shared by another seg since (see NewVertexFromSplitSeg), so the
+   * open status is checked again.
+   */
   for (cut=(*cut_list); cut; cut=cut->next)
   {
     if (vert == cut->vertex)
+    {
+      cut->before = VertexCheckOpen(vert, -part->pdx, -part->pdy);
+      cut->after  = VertexCheckOpen(vert,  part->pdx,  part->pdy);
       return;
+    }
   }
 
   /* create new intersection */
@@ -342,10 +354,15 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
 
   float_g qnty;
   float_g a, b, fa, fb;
+  float_g ca, cb;
 
   int num;
   int factor = cur_info->factor;
 
+  // segs further than this (times the partition length) from the
+  // partition line are neither split nor a near miss.
+  float_g clear = IFFY_LEN * part->p_length * (1.0 + PERP_FILTER_MARGIN);
+
   // -AJA- this is the heart of my superblock idea, it tests the
   //       _whole_ block against the partition line to quickly handle
   //       all the segs within it at once.  Only when the partition
@@ -401,8 +418,26 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
     }
     else
     {
-      a = UtilPerpDist(part, check->psx, check->psy);
-      b = UtilPerpDist(part, check->pex, check->pey);
+      ca = UtilPerpCross(part, check->psx, check->psy);
+      cb = UtilPerpCross(part, check->pex, check->pey);
+
+      // quick check for segs well clear of the partition (the usual
+      // case), which avoids the divisions below.
+
+      if (ca > clear && cb > clear)
+      {
+        ADD_RIGHT();
+        continue;
+      }
+
+      if (ca < -clear && cb < -clear)
+      {
+        ADD_LEFT();
+        continue;
+      }
+
+      a = ca / part->p_length;
+      b = cb / part->p_length;
 
       fa = fabs(a);
       fb = fabs(b);
@@ -693,6 +728,147 @@ static seg_t *FindFastSeg(superblock_t *seg_list, const bbox_t *bbox)
 }
 
 
+static int coarse_stamp = 0;
+
+static void CollectRunsWorker(superblock_t *seg_list,
+    seg_t **runs, int *num_runs)
+{
+  seg_t *part;
+  int num;
+
+  for (part=seg_list->segs; part; part = part->next)
+  {
+    linedef_t *first;
+
+    if (! part->linedef || ! part->linedef->run)
+      continue;
+
+    first = part->linedef->run;
+
+    if (first->run_stamp != coarse_stamp)
+    {
+      first->run_stamp = coarse_stamp;
+      first->run_len = 0;
+
+      runs[(*num_runs)++] = part;
+    }
+
+    first->run_len += part->p_length;
+  }
+
+  /* handle sub-blocks recursively */
+
+  for (num=0; num < 2; num++)
+  {
+    if (! seg_list->subs[num])
+      continue;
+
+    CollectRunsWorker(seg_list->subs[num], runs, num_runs);
+  }
+}
+
+static int RunLengthCompare(const void *p1, const void *p2)
+{
+  const linedef_t *A = (*(seg_t * const *) p1)->linedef->run;
+  const linedef_t *B = (*(seg_t * const *) p2)->linedef->run;
+
+  if (A->run_len != B->run_len)
+    return (A->run_len > B->run_len) ? -1 : +1;
+
+  return A->index - B->index;
+}
+
+//
+// FindCoarseSeg
+//
+// Used by -strategy boundary.  The total length of segs on each
+// boundary run (see DetectBoundaryRuns) in this group is found, and
+// one seg from each of the longest runs is evaluated as the partition.
+// Returns the best one, or NULL if none are suitable.
+//
+static seg_t *FindCoarseSeg(superblock_t *seg_list)
+{
+  seg_t **runs = UtilCalloc(seg_list->real_num * sizeof(seg_t *));
+  seg_t *best = NULL;
+
+  int best_cost = INT_MAX;
+  int num_runs = 0;
+  int i;
+
+  coarse_stamp++;
+
+  CollectRunsWorker(seg_list, runs, &num_runs);
+
+  qsort(runs, num_runs, sizeof(seg_t *), RunLengthCompare);
+
+  for (i=0; i < num_runs && i < COARSE_CANDIDATES; i++)
+  {
+    int cost = EvalPartition(seg_list, runs[i], best_cost);
+
+    if (cost < 0 || cost >= best_cost)
+      continue;
+
+    best_cost = cost;
+    best = runs[i];
+  }
+
+# if DEBUG_PICKNODE
+  PrintDebug("FindCoarseSeg: %d runs, best=%p (cost %d)\n",
+             num_runs, best, best ? best_cost : -1);
+# endif
+
+  UtilFree(runs);
+
+  return best;
+}
+
+
+//
+// SegsInConvexSector
+//
+// Checks whether all the real segs in the list (and sub-blocks) come
+// from the one convex sector.  'sec' should be NULL initially, and is
+// set to that sector.
+//
+static boolean_g SegsInConvexSector(superblock_t *seg_list,
+    sector_t **sec)
+{
+  seg_t *cur;
+  int num;
+
+  for (cur=seg_list->segs; cur; cur=cur->next)
+  {
+    sidedef_t *side;
+
+    if (! cur->linedef)
+      continue;
+
+    side = cur->side ? cur->linedef->left : cur->linedef->right;
+
+    // this also catches the extra seg of a One-Sided Window
+    if (! side || side->sector != cur->sector || ! cur->sector)
+      return FALSE;
+
+    if (! cur->sector->is_convex ||
+        cur->p_length <= cur->sector->convex_min_len)
+      return FALSE;
+
+    if (*sec && *sec != cur->sector)
+      return FALSE;
+
+    *sec = cur->sector;
+  }
+
+  for (num=0; num < 2; num++)
+  {
+    if (seg_list->subs[num] && ! SegsInConvexSector(seg_list->subs[num], sec))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+
 /* returns FALSE if cancelled */
 static int PickNodeWorker(superblock_t *part_list, 
     superblock_t *seg_list, seg_t ** best, int *best_cost,
@@ -798,6 +974,27 @@ seg_t *PickNode(superblock_t *seg_list, int depth, const bbox_t *bbox)
 
   DisplayTicker();
 
+  /* segs from a single convex sector will never have a real seg on
+   * their left side, so no partition can be found.
+   */
+  if (seg_list->real_num > 0)
+  {
+    sector_t *sec = NULL;
+
+    if (SegsInConvexSector(seg_list, &sec))
+    {
+      cur_comms->build_pos += build_step;
+      DisplaySetBar(1, cur_comms->build_pos);
+      DisplaySetBar(2, cur_comms->file_pos + cur_comms->build_pos / 100);
+
+#     if DEBUG_PICKNODE
+      PrintDebug("PickNode: Convex sector %d\n", sec->index);
+#     endif
+
+      return NULL;
+    }
+  }
+
   /* -AJA- another (optional) optimisation, when building just the GL
    *       nodes.  We assume that the original nodes are reasonably
    *       good choices, and re-use them as much as possible, saving
@@ -827,6 +1024,31 @@ seg_t *PickNode(superblock_t *seg_list, int depth, const bbox_t *bbox)
     }
   }
 
+  /* -strategy boundary: large groups of segs are first split along
+   *       the long runs of sector boundaries, and the normal search
+   *       only happens once the groups are small.
+   */
+  if (cur_info->build_strategy == STRATEGY_BOUNDARY &&
+      seg_list->real_num >= SEG_COARSE_THRESHHOLD)
+  {
+    best = FindCoarseSeg(seg_list);
+
+    if (best)
+    {
+      /* update progress */
+      cur_comms->build_pos += build_step;
+      DisplaySetBar(1, cur_comms->build_pos);
+      DisplaySetBar(2, cur_comms->file_pos + cur_comms->build_pos / 100);
+
+#     if DEBUG_PICKNODE
+      PrintDebug("PickNode: Using Coarse node (%1.1f,%1.1f) -> (%1.1f,%1.1f)\n",
+          best->start->x, best->start->y, best->end->x, best->end->y);
+#     endif
+
+      return best;
+    }
+  }
+
   if (FALSE == PickNodeWorker(seg_list, seg_list, &best, &best_cost, 
       &progress, prog_step))
   {
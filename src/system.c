@@ -29,6 +29,17 @@
 #include <limits.h>
 #include <assert.h>
 
+#if defined(UNIX) && !defined(GLBSP_NO_THREADS)
+#define THREADS_PTHREAD  1
+#include <pthread.h>
+#include <unistd.h>
+#elif defined(WIN32) && !defined(GLBSP_NO_THREADS)
+#define THREADS_WIN32  1
+#include <windows.h>
+#endif
+
+#include "util.h"
+
 
 #define DEBUG_ENABLED   0
 
@@ -274,6 +285,15 @@ void InitEndian(void)
   else
     FatalError("Sanity check failed: weird endianness (0x%08x)", u.val);
 
+# if defined(GLBSP_LITTLE_ENDIAN) || defined(GLBSP_BIG_ENDIAN)
+#   if defined(GLBSP_BIG_ENDIAN)
+  if (! cpu_big_endian)
+#   else
+  if (cpu_big_endian)
+#   endif
+    FatalError("Sanity check failed: compiled for the wrong endianness");
+# endif
+
 # if DEBUG_ENDIAN
   PrintDebug("Endianness = %s\n", cpu_big_endian ? "BIG" : "LITTLE");
 
@@ -285,6 +305,7 @@ void InitEndian(void)
 # endif
 }
 
+#ifndef Endian_U16
 //
 // Endian_U16
 //
@@ -307,4 +328,166 @@ uint32_g Endian_U32(uint32_g x)
   else
     return x;
 }
+#endif
+
+#ifndef Endian_Array16
+//
+// Endian_Array16
+//
+// The loops here are kept simple so that the compiler can turn them
+// into vector shuffles.
+//
+void Endian_Array16(void *data, int count)
+{
+  uint16_g *p = (uint16_g *) data;
+  int i;
+
+# if !defined(GLBSP_BIG_ENDIAN)
+  if (! cpu_big_endian)
+    return;
+# endif
+
+  for (i=0; i < count; i++)
+    p[i] = (uint16_g) ((p[i] >> 8) | (p[i] << 8));
+}
+
+//
+// Endian_Array32
+//
+void Endian_Array32(void *data, int count)
+{
+  uint32_g *p = (uint32_g *) data;
+  int i;
+
+# if !defined(GLBSP_BIG_ENDIAN)
+  if (! cpu_big_endian)
+    return;
+# endif
+
+  for (i=0; i < count; i++)
+    p[i] = (p[i] >> 24) | ((p[i] >> 8) & 0xff00) |
+           ((p[i] << 8) & 0xff0000) | (p[i] << 24);
+}
+#endif
+
+
+
+/* -------- thread code ----------------------------- */
+
+// stack size for the helper threads.  The defaults differ a lot
+// between systems (only 1MB on Win32), so always ask for this.
+#define THREAD_STACK_SIZE  (4 << 20)
+
+struct thread_s
+{
+  void (* func)(void *);
+  void *data;
+
+  // FALSE when the function has already been run
+  boolean_g running;
+
+# if defined(THREADS_PTHREAD)
+  pthread_t handle;
+# elif defined(THREADS_WIN32)
+  HANDLE handle;
+# endif
+};
+
+#if defined(THREADS_PTHREAD)
+static void *ThreadTrampoline(void *arg)
+{
+  thread_t *thr = (thread_t *) arg;
+
+  (* thr->func)(thr->data);
+
+  return NULL;
+}
+#elif defined(THREADS_WIN32)
+static DWORD WINAPI ThreadTrampoline(LPVOID arg)
+{
+  thread_t *thr = (thread_t *) arg;
 
+  (* thr->func)(thr->data);
+
+  return 0;
+}
+#endif
+
+//
+// ThreadStart
+//
+thread_t *ThreadStart(void (* func)(void *), void *data)
+{
+  thread_t *thr = (thread_t *) UtilCalloc(sizeof(thread_t));
+
+  thr->func = func;
+  thr->data = data;
+
+# if defined(THREADS_PTHREAD)
+  {
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+
+    if (pthread_create(&thr->handle, &attr, ThreadTrampoline, thr) == 0)
+      thr->running = TRUE;
+
+    pthread_attr_destroy(&attr);
+  }
+# elif defined(THREADS_WIN32)
+  thr->handle = CreateThread(NULL, THREAD_STACK_SIZE, ThreadTrampoline,
+      thr, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+
+  if (thr->handle)
+    thr->running = TRUE;
+# endif
+
+  // no thread, so do the work here and now
+  if (! thr->running)
+    (* func)(data);
+
+  return thr;
+}
+
+//
+// ThreadJoin
+//
+void ThreadJoin(thread_t *thr)
+{
+  if (thr->running)
+  {
+#   if defined(THREADS_PTHREAD)
+    pthread_join(thr->handle, NULL);
+#   elif defined(THREADS_WIN32)
+    WaitForSingleObject(thr->handle, INFINITE);
+    CloseHandle(thr->handle);
+#   endif
+  }
+
+  UtilFree(thr);
+}
+
+//
+// ThreadCount
+//
+int ThreadCount(void)
+{
+  int count = cur_info->num_threads;
+
+  if (count > 0)
+    return count;
+
+# if defined(THREADS_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+  count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+# elif defined(THREADS_WIN32)
+  {
+    SYSTEM_INFO sys_info;
+
+    GetSystemInfo(&sys_info);
+    count = (int) sys_info.dwNumberOfProcessors;
+  }
+# endif
+
+  return MAX(1, count);
+}
@@ -52,10 +52,56 @@ void PrintMiniWarn(const char *str, ...) GCCATTR((format (printf, 1, 2)));
 // set message for certain errors
 void SetErrorMsg(const char *str, ...) GCCATTR((format (printf, 1, 2)));
 
-// endian handling
+// endian handling.  The byte order is normally known at compile
+// time, in which case conversion is free on little-endian hosts.
+// Otherwise (or when -DGLBSP_NO_FIXED_ENDIAN is given) it is checked
+// at run time.
+#if !defined(GLBSP_LITTLE_ENDIAN) && !defined(GLBSP_BIG_ENDIAN) && \
+    !defined(GLBSP_NO_FIXED_ENDIAN) && defined(__BYTE_ORDER__)
+#if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define GLBSP_LITTLE_ENDIAN  1
+#elif (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define GLBSP_BIG_ENDIAN  1
+#endif
+#endif
+
 void InitEndian(void);
+
+#if defined(GLBSP_LITTLE_ENDIAN)
+#define Endian_U16(x)  ((uint16_g) (x))
+#define Endian_U32(x)  ((uint32_g) (x))
+#elif defined(GLBSP_BIG_ENDIAN) && defined(__GNUC__)
+#define Endian_U16(x)  ((uint16_g) __builtin_bswap16((uint16_g) (x)))
+#define Endian_U32(x)  ((uint32_g) __builtin_bswap32((uint32_g) (x)))
+#else
 uint16_g Endian_U16(uint16_g);
 uint32_g Endian_U32(uint32_g);
+#endif
+
+// bulk conversion of whole arrays of 16 or 32 bit values, in place,
+// between little-endian (as in wad files) and native order.  Doing
+// it twice gives back the original data.
+#if defined(GLBSP_LITTLE_ENDIAN)
+#define Endian_Array16(data, count)  ((void) 0)
+#define Endian_Array32(data, count)  ((void) 0)
+#else
+void Endian_Array16(void *data, int count);
+void Endian_Array32(void *data, int count);
+#endif
+
+// simple worker threads.  ThreadStart() runs func(data) on a new
+// thread and returns a handle for ThreadJoin(), which waits for it
+// to finish and frees the handle.  When threads are not available
+// (or cannot be created) the function is simply run right away.
+// Worker code must not call the Print*/Display* routines.
+typedef struct thread_s thread_t;
+
+thread_t *ThreadStart(void (* func)(void *), void *data);
+void ThreadJoin(thread_t *thr);
+
+// number of worker threads to use: the -threads value, or the
+// number of CPUs when that is zero.
+int ThreadCount(void);
 
 // these are only used for debugging
 void InitDebug(void);
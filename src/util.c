@@ -264,6 +264,68 @@ char *UtilTimeString(void)
 #endif  
 }
 
+//------------------------------------------------------------------------
+//  DISJOINT SETS
+//------------------------------------------------------------------------
+
+dset_t *DSet_Create(int size)
+{
+  dset_t *set = UtilCalloc(sizeof(dset_t));
+  int i;
+
+  set->size   = size;
+  set->parent = UtilCalloc(MAX(1, size) * sizeof(int));
+  set->rank   = UtilCalloc(MAX(1, size));
+
+  for (i=0; i < size; i++)
+    set->parent[i] = i;
+
+  return set;
+}
+
+void DSet_Free(dset_t *set)
+{
+  UtilFree(set->parent);
+  UtilFree(set->rank);
+  UtilFree(set);
+}
+
+int DSet_Find(dset_t *set, int x)
+{
+  int *parent = set->parent;
+
+  // path halving: every node on the way points to its grandparent
+  while (parent[x] != x)
+  {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+
+  return x;
+}
+
+void DSet_Union(dset_t *set, int a, int b)
+{
+  a = DSet_Find(set, a);
+  b = DSet_Find(set, b);
+
+  if (a == b)
+    return;
+
+  if (set->rank[a] < set->rank[b])
+  {
+    set->parent[a] = b;
+  }
+  else
+  {
+    set->parent[b] = a;
+
+    if (set->rank[a] == set->rank[b])
+      set->rank[a]++;
+  }
+}
+
+
 //------------------------------------------------------------------------
 //  Adler-32 CHECKSUM Code
 //------------------------------------------------------------------------
@@ -292,3 +354,44 @@ void Adler32_Finish(uint32_g *crc)
   /* nothing to do */
 }
 
+
+//------------------------------------------------------------------------
+//  FNV-1a 64-bit HASH Code
+//------------------------------------------------------------------------
+
+// The hash is kept in two 32-bit halves, since there is no portable
+// 64-bit integer type.  The prime is 2^40 + 0x1b3.
+
+void FNV64_Begin(fnv64_t *hash)
+{
+  hash->hi = 0xcbf29ce4;
+  hash->lo = 0x84222325;
+}
+
+void FNV64_AddBlock(fnv64_t *hash, const uint8_g *data, int length)
+{
+  for (; length > 0; data++, length--)
+  {
+    uint32_g lo = hash->lo ^ *data;
+    uint32_g hi = hash->hi;
+
+    // multiply by 0x1b3, 16 bits at a time
+    uint32_g c;
+    uint32_g a0, a1, a2, a3;
+
+    c = (lo & 0xFFFF) * 0x1b3;        a0 = c & 0xFFFF;  c >>= 16;
+    c += (lo >> 16)   * 0x1b3;        a1 = c & 0xFFFF;  c >>= 16;
+    c += (hi & 0xFFFF) * 0x1b3;       a2 = c & 0xFFFF;  c >>= 16;
+    c += (hi >> 16)   * 0x1b3;        a3 = c & 0xFFFF;
+
+    // ...and add the part from 2^40
+    hash->lo = (a1 << 16) | a0;
+    hash->hi = ((a3 << 16) | a2) + (lo << 8);
+  }
+}
+
+void FNV64_Finish(fnv64_t *hash)
+{
+  /* nothing to do */
+}
+
@@ -84,15 +84,59 @@ angle_g UtilComputeAngle(float_g dx, float_g dy);
      / (part)->p_length)
 
 #define UtilPerpDist(part,x,y)  \
-    (((x) * (part)->pdy - (y) * (part)->pdx + (part)->p_perp)  \
-     / (part)->p_length)
+    (UtilPerpCross(part,x,y) / (part)->p_length)
+
+// the perpendicular distance scaled by the partition's length, i.e.
+// the cross product.  Cheaper (no division), and exact when all the
+// coordinates are integers (as the products fit in a double).
+//
+#define UtilPerpCross(part,x,y)  \
+    ((x) * (part)->pdy - (y) * (part)->pdx + (part)->p_perp)
+
+// relative margin for comparing UtilPerpCross with a distance times
+// the partition length.  Outside the margin the result is the same
+// as comparing UtilPerpDist with that distance, inside it the caller
+// must use UtilPerpDist.
+//
+#define PERP_FILTER_MARGIN  (1.0 / (1 << 20))
 
 // check if the file exists.
 int UtilFileExists(const char *filename);
 
+// disjoint sets of the numbers 0 .. size-1, for finding connected
+// components (union-find with path compression and union by rank).
+typedef struct dset_s
+{
+  int size;
+
+  int *parent;
+  uint8_g *rank;
+}
+dset_t;
+
+dset_t *DSet_Create(int size);
+void DSet_Free(dset_t *set);
+
+// returns the representative of the set containing x.
+int DSet_Find(dset_t *set, int x);
+
+// merges the sets containing a and b.
+void DSet_Union(dset_t *set, int a, int b);
+
 // checksum functions
 void Adler32_Begin(uint32_g *crc);
 void Adler32_AddBlock(uint32_g *crc, const uint8_g *data, int length);
 void Adler32_Finish(uint32_g *crc);
 
+// 64-bit FNV-1a hash, for when a collision must be very unlikely
+typedef struct fnv64_s
+{
+  uint32_g hi, lo;
+}
+fnv64_t;
+
+void FNV64_Begin(fnv64_t *hash);
+void FNV64_AddBlock(fnv64_t *hash, const uint8_g *data, int length);
+void FNV64_Finish(fnv64_t *hash);
+
 #endif /* __GLBSP_UTIL_H__ */
@@ -43,6 +43,10 @@
 static FILE *in_file = NULL;
 static FILE *out_file = NULL;
 
+// second handle on the input wad, used by the pipeline's writer
+// thread to copy lumps while the reader thread is using 'in_file'.
+static FILE *copy_file = NULL;
+
 
 #define DEBUG_DIR   0
 #define DEBUG_LUMP  0
@@ -51,6 +55,10 @@ static FILE *out_file = NULL;
 #define APPEND_BLKSIZE  256
 #define LEVNAME_BUNCH   20
 
+// GL markers bigger than this are not kept (they only hold a few
+// keyword lines)
+#define MAX_OLD_GL_TEXT  4096
+
 #define ALIGN_LEN(len)  ((((len) + 3) / 4) * 4)
 
 
@@ -96,40 +104,162 @@ static int CheckMagic(const char type[4])
 }
 
 
+/* ----- lump name index ----------------------- */
+
+// An open-addressing hash table over the interesting lump names
+// (level lumps, GL lumps and level markers), so that classifying
+// each directory entry doesn't need a string compare against every
+// known name.  It is built in ReadDirectory().
+
+#define NAME_LEVEL_LUMP   0x00FF  /* 1 + index into level_lumps[] */
+#define NAME_GL_LUMP      0x0100
+#define NAME_LEVEL        0x0200
+
+typedef struct name_slot_s
+{
+  // NULL for an empty slot.  Not owned by the table.
+  const char *name;
+
+  // combination of the NAME_XXX values above
+  int code;
+}
+name_slot_t;
+
+#define NAME_INDEX_INIT   64
+
+static name_slot_t *name_slots = NULL;
+static int name_size  = 0;  // always a power of two
+static int name_count = 0;
+
+
 //
-// CheckLevelName
+// NameHash
 //
-static int CheckLevelName(const char *name)
+static INLINE_G unsigned int NameHash(const char *name)
 {
-  int n;
-  
-  for (n=0; n < wad.num_level_names; n++)
+  // FNV-1a
+  unsigned int hash = 2166136261U;
+
+  for (; *name; name++)
+    hash = (hash ^ (unsigned char) *name) * 16777619U;
+
+  return hash;
+}
+
+//
+// NameSlot
+//
+// Returns the slot containing the name, or the empty slot where it
+// would go.
+//
+static name_slot_t *NameSlot(const char *name)
+{
+  unsigned int i = NameHash(name) & (name_size - 1);
+
+  while (name_slots[i].name && strcmp(name_slots[i].name, name) != 0)
+    i = (i + 1) & (name_size - 1);
+
+  return name_slots + i;
+}
+
+//
+// NameLookup
+//
+static INLINE_G int NameLookup(const char *name)
+{
+  if (! name_slots)
+    return 0;
+
+  return NameSlot(name)->code;
+}
+
+//
+// NameInsert
+//
+static void NameInsert(const char *name, int code)
+{
+  name_slot_t *slot;
+
+  // keep the table at most half full
+  if ((name_count + 1) * 2 > name_size)
+  {
+    name_slot_t *old_slots = name_slots;
+    int old_size = name_size;
+    int i;
+
+    name_size  = old_size ? old_size * 2 : NAME_INDEX_INIT;
+    name_slots = UtilCalloc(name_size * sizeof(name_slot_t));
+
+    for (i=0; i < old_size; i++)
+      if (old_slots[i].name)
+        *NameSlot(old_slots[i].name) = old_slots[i];
+
+    if (old_slots)
+      UtilFree(old_slots);
+  }
+
+  slot = NameSlot(name);
+
+  if (! slot->name)
   {
-    if (strcmp(wad.level_names[n], name) == 0)
-      return TRUE;
+    slot->name = name;
+    name_count++;
   }
 
-  return FALSE;
+  slot->code |= code;
 }
 
-
 //
-// CheckLevelLumpName
+// InitNameIndex
 //
-// Tests if the entry name is one of the level lumps.
-// Returns index after header (1..N), or zero if no match.
+// Creates the name table and adds the known lump names.  Level
+// names are added later by AddLevelName().
 //
-static int CheckLevelLumpName(const char *name)
+static void InitNameIndex(void)
 {
   int i;
 
   for (i=0; i < NUM_LEVEL_LUMPS; i++)
+    NameInsert(level_lumps[i], 1 + i);
+
+  for (i=0; i < NUM_GL_LUMPS; i++)
+    NameInsert(gl_lumps[i], NAME_GL_LUMP);
+}
+
+//
+// FreeNameIndex
+//
+static void FreeNameIndex(void)
+{
+  if (name_slots)
   {
-    if (strcmp(name, level_lumps[i]) == 0)
-      return 1 + i;
+    UtilFree(name_slots);
+    name_slots = NULL;
   }
- 
-  return 0;
+
+  name_size  = 0;
+  name_count = 0;
+}
+
+
+//
+// CheckLevelName
+//
+static int CheckLevelName(const char *name)
+{
+  return (NameLookup(name) & NAME_LEVEL) ? TRUE : FALSE;
+}
+
+
+//
+// CheckLevelLumpName
+//
+// Tests if the entry name is one of the level lumps.
+// Returns index after header (1..N), or zero if no match.
+//
+static int CheckLevelLumpName(const char *name)
+{
+  return NameLookup(name) & NAME_LEVEL_LUMP;
 }
 
 
@@ -137,20 +267,18 @@ static int CheckLevelLumpName(const char *name)
 // CheckGLLumpName
 //
 // Tests if the entry name matches GL_ExMy or GL_MAPxx, or one of the
-// GL lump names.
+// GL lump names.  GL_LEVEL is the marker used for long level names.
 //
 static int CheckGLLumpName(const char *name)
 {
-  int i;
-
   if (name[0] != 'G' || name[1] != 'L' || name[2] != '_')
     return FALSE;
 
-  for (i=0; i < NUM_GL_LUMPS; i++)
-  {
-    if (strcmp(name, gl_lumps[i]) == 0)
-      return TRUE;
-  }
+  if (NameLookup(name) & NAME_GL_LUMP)
+    return TRUE;
+
+  if (strcmp(name, "GL_LEVEL") == 0)
+    return TRUE;
   
   return CheckLevelName(name+3);
 }
@@ -168,6 +296,9 @@ static INLINE_G void AddLevelName(const char *name)
   }
 
   wad.level_names[wad.num_level_names] = UtilStrDup(name);
+
+  NameInsert(wad.level_names[wad.num_level_names], NAME_LEVEL);
+
   wad.num_level_names++;
 }
 
@@ -207,6 +338,7 @@ static lump_t *NewLump(char *name)
   cur->space = 0;
   cur->data = NULL;
   cur->lev_info = NULL;
+  cur->deflate_start = 0;
 
   return cur;
 }
@@ -228,6 +360,9 @@ static void FreeWadLevel(level_t *level)
     FreeLump(head);
   }
 
+  if (level->old_gl_text)
+    UtilFree(level->old_gl_text);
+
   UtilFree(level);
 }
 
@@ -383,6 +518,34 @@ static void DetermineLevelNames(void)
   }
 }
 
+static boolean_g FetchLumpData(FILE *fp, lump_t *lump);
+static char *FindGLTextValue(const char *text, const char *keyword);
+
+//
+// OldGLTextMatches
+//
+// Checks that the text of an old GL marker belongs to the current
+// level.  GL_LEVEL is shared by all the levels with long names, so
+// its LEVEL= line must match.
+//
+static boolean_g OldGLTextMatches(const char *marker, const char *text)
+{
+  char *value;
+  boolean_g result;
+
+  if (strcmp(marker + 3, wad.current_level->name) == 0)
+    return TRUE;
+
+  value = FindGLTextValue(text, "LEVEL");
+
+  result = (value && UtilStrCaseCmp(value, wad.current_level->name) == 0);
+
+  if (value)
+    UtilFree(value);
+
+  return result;
+}
+
 //
 // ProcessDirEntry
 //
@@ -397,6 +560,28 @@ static void ProcessDirEntry(lump_t *lump)
     PrintDebug("Discarding previous GL info: %s\n", lump->name);
 #   endif
 
+    // but remember the text in the marker of the current level.
+    // Levels with long names use GL_LEVEL, with a LEVEL= line.
+    if (wad.current_level && lump->length > 0 &&
+        lump->length <= MAX_OLD_GL_TEXT &&
+        (strcmp(lump->name + 3, wad.current_level->name) == 0 ||
+         strcmp(lump->name, "GL_LEVEL") == 0) &&
+        FetchLumpData(in_file, lump))
+    {
+      level_t *level = wad.current_level->lev_info;
+      char *text = UtilStrNDup(lump->data, lump->length);
+
+      if (OldGLTextMatches(lump->name, text))
+      {
+        if (level->old_gl_text)
+          UtilFree(level->old_gl_text);
+
+        level->old_gl_text = text;
+      }
+      else
+        UtilFree(text);
+    }
+
     FreeLump(lump);
     wad.num_entries--;
 
@@ -520,6 +705,8 @@ static void ReadDirectory(void)
 
   fseek(in_file, wad.dir_start, SEEK_SET);
 
+  InitNameIndex();
+
   for (i=0; i < total_entries; i++)
   {
     ReadDirEntry();
@@ -543,12 +730,29 @@ static void ReadDirectory(void)
 
 
 //
-// ReadLumpData
+// FetchLumpData
 //
-static void ReadLumpData(lump_t *lump)
+// Loads the lump's data from the given file.  Safe to use on the
+// pipeline threads.  Returns FALSE if there was a read error.
+//
+static boolean_g FetchLumpData(FILE *fp, lump_t *lump)
 {
   size_t len;
 
+  lump->data = UtilCalloc(lump->length);
+
+  fseek(fp, lump->start, SEEK_SET);
+
+  len = fread(lump->data, lump->length, 1, fp);
+
+  return (len == 1);
+}
+
+//
+// ReadLumpData
+//
+static void ReadLumpData(lump_t *lump)
+{
   cur_comms->file_pos++;
   DisplaySetBar(1, cur_comms->file_pos);
   DisplayTicker();
@@ -560,13 +764,7 @@ static void ReadLumpData(lump_t *lump)
   if (lump->length == 0)
     return;
 
-  lump->data = UtilCalloc(lump->length);
-
-  fseek(in_file, lump->start, SEEK_SET);
-
-  len = fread(lump->data, lump->length, 1, in_file);
-
-  if (len != 1)
+  if (! FetchLumpData(in_file, lump))
   {
     if (wad.current_level)
       PrintWarn("Trouble reading lump '%s' in %s\n",
@@ -762,6 +960,18 @@ static void SortLumps(lump_t ** list, const char **names, int count)
 }
 
 
+//
+// SortLevelLumps
+//
+static void SortLevelLumps(level_t *lev)
+{
+  if (lev->flags & LEVEL_IS_GL)
+    SortLumps(&lev->children, gl_lumps, NUM_GL_LUMPS);
+  else
+    SortLumps(&lev->children, level_lumps, NUM_LEVEL_LUMPS);
+}
+
+
 //
 // RecomputeDirectory
 //
@@ -793,10 +1003,7 @@ static void RecomputeDirectory(void)
 
     if (lev)
     {
-      if (lev->flags & LEVEL_IS_GL)
-        SortLumps(&lev->children, gl_lumps, NUM_GL_LUMPS);
-      else
-        SortLumps(&lev->children, level_lumps, NUM_LEVEL_LUMPS);
+      SortLevelLumps(lev);
 
       for (L=lev->children; L; L=L->next)
       {
@@ -814,13 +1021,32 @@ static void RecomputeDirectory(void)
 
 
 //
-// WriteLumpData
+// StoreLumpData
 //
-static void WriteLumpData(lump_t *lump)
+// Writes the lump's data to the output file, padded to a multiple
+// of four bytes.  Safe to use on the pipeline threads.  Returns
+// FALSE if there was a write error.
+//
+static boolean_g StoreLumpData(lump_t *lump)
 {
   size_t len;
   int align_size;
 
+  len = fwrite(lump->data, lump->length, 1, out_file);
+   
+  align_size = ALIGN_LEN(lump->length) - lump->length;
+
+  if (align_size > 0)
+    fwrite(align_filler, align_size, 1, out_file);
+
+  return (len == 1);
+}
+
+//
+// WriteLumpData
+//
+static void WriteLumpData(lump_t *lump)
+{
   cur_comms->file_pos++;
   DisplaySetBar(1, cur_comms->file_pos);
   DisplayTicker();
@@ -841,26 +1067,13 @@ static void WriteLumpData(lump_t *lump)
 
   if (lump->flags & LUMP_COPY_ME)
   {
-    lump->data = UtilCalloc(lump->length);
-
-    fseek(in_file, lump->start, SEEK_SET);
-
-    len = fread(lump->data, lump->length, 1, in_file);
-
-    if (len != 1)
+    if (! FetchLumpData(in_file, lump))
       PrintWarn("Trouble reading lump %s to copy\n", lump->name);
   }
 
-  len = fwrite(lump->data, lump->length, 1, out_file);
-   
-  if (len != 1)
+  if (! StoreLumpData(lump))
     PrintWarn("Trouble writing lump %s\n", lump->name);
   
-  align_size = ALIGN_LEN(lump->length) - lump->length;
-
-  if (align_size > 0)
-    fwrite(align_filler, align_size, 1, out_file);
-
   UtilFree(lump->data);
 
   lump->data = NULL;
@@ -978,6 +1191,324 @@ static int WriteDirectory(void)
 }
 
 
+/* ----- read/build/write pipeline -------------------------------- */
+
+//
+// While the builder works on level N, a reader thread loads the
+// lumps of level N+1 and a writer thread writes out level N-1
+// (compressing any ZDoom nodes first).  Each stage handles a range
+// of top-level lumps, from 'first' up to (not including) 'last', and
+// a NULL 'last' means the rest of the directory.  The lumps of the
+// level being built always lie between the two ranges.
+//
+
+typedef struct pipe_job_s
+{
+  lump_t *first;
+  lump_t *last;
+
+  // the first problem encountered, since the threads cannot call
+  // PrintWarn() themselves.
+  char *trouble;
+}
+pipe_job_t;
+
+static boolean_g pipe_active = FALSE;
+
+// output filename, NULL once the output wad is complete
+static char *pipe_filename = NULL;
+
+static lump_t *pipe_read_pos;
+static lump_t *pipe_read_level;
+static lump_t *pipe_write_pos;
+
+// entries in the directory as read, and how many of them the reader
+// stage has gone through (checked by FinishPipeline).
+static int pipe_dir_entries;
+static int pipe_read_entries;
+
+// these are only touched by the writer stage
+static int pipe_offset;
+static int pipe_entries;
+
+static pipe_job_t read_job;
+static pipe_job_t write_job;
+
+static thread_t *read_thread  = NULL;
+static thread_t *write_thread = NULL;
+
+
+static const char *DeflateLump(lump_t *lump);
+static void ZLibWait(void);
+
+//
+// PipeReadLump
+//
+static void PipeReadLump(pipe_job_t *job, lump_t *lump)
+{
+  if (lump->length == 0)
+    return;
+
+  if (! FetchLumpData(in_file, lump) && ! job->trouble)
+    job->trouble = UtilFormat("Trouble reading lump '%s'\n", lump->name);
+
+  lump->flags &= ~LUMP_READ_ME;
+}
+
+//
+// PipeReadWorker
+//
+static void PipeReadWorker(void *data)
+{
+  pipe_job_t *job = (pipe_job_t *) data;
+  lump_t *cur, *L;
+
+  for (cur=job->first; cur != job->last; cur=cur->next)
+  {
+    pipe_read_entries++;
+
+    if (cur->flags & LUMP_READ_ME)
+      PipeReadLump(job, cur);
+
+    if (cur->lev_info && ! (cur->lev_info->flags & LEVEL_IS_GL))
+    {
+      for (L=cur->lev_info->children; L; L=L->next)
+      {
+        pipe_read_entries++;
+
+        if (L->flags & LUMP_READ_ME)
+          PipeReadLump(job, L);
+      }
+    }
+  }
+}
+
+//
+// PipeWriteLump
+//
+static void PipeWriteLump(pipe_job_t *job, lump_t *lump)
+{
+  if (lump->flags & LUMP_DEFLATE_ME)
+  {
+    const char *msg = DeflateLump(lump);
+
+    if (msg && ! job->trouble)
+      job->trouble = UtilFormat("%s", msg);
+  }
+
+  lump->new_start = pipe_offset;
+
+  pipe_offset += ALIGN_LEN(lump->length);
+  pipe_entries++;
+
+  if (lump->length == 0)
+    return;
+
+  if (lump->flags & LUMP_COPY_ME)
+  {
+    if (! FetchLumpData(copy_file, lump) && ! job->trouble)
+      job->trouble = UtilFormat("Trouble reading lump %s to copy\n",
+          lump->name);
+  }
+
+  if (! StoreLumpData(lump) && ! job->trouble)
+    job->trouble = UtilFormat("Trouble writing lump %s\n", lump->name);
+
+  UtilFree(lump->data);
+
+  lump->data = NULL;
+}
+
+//
+// PipeWriteWorker
+//
+static void PipeWriteWorker(void *data)
+{
+  pipe_job_t *job = (pipe_job_t *) data;
+  lump_t *cur, *L;
+
+  for (cur=job->first; cur != job->last; cur=cur->next)
+  {
+    if (cur->flags & LUMP_IGNORE_ME)
+      continue;
+
+    PipeWriteLump(job, cur);
+
+    if (cur->lev_info)
+    {
+      SortLevelLumps(cur->lev_info);
+
+      for (L=cur->lev_info->children; L; L=L->next)
+      {
+        if (L->flags & LUMP_IGNORE_ME)
+          continue;
+
+        PipeWriteLump(job, L);
+      }
+    }
+  }
+}
+
+//
+// PipeFinishJob
+//
+// Wait for the stage's thread (if any) and report its problems.
+//
+static void PipeFinishJob(thread_t **thr, pipe_job_t *job)
+{
+  if (*thr)
+  {
+    ThreadJoin(*thr);
+    (*thr) = NULL;
+  }
+
+  if (job->trouble)
+  {
+    PrintWarn("%s", job->trouble);
+
+    UtilFree(job->trouble);
+    job->trouble = NULL;
+  }
+}
+
+//
+// PipeAdvance
+//
+// Called when moving from the current level to the 'next' one (NULL
+// when there are no more levels).
+//
+static void PipeAdvance(lump_t *next)
+{
+  lump_t *after;
+
+  PipeFinishJob(&read_thread, &read_job);
+
+  // the very first level has not been prefetched
+  if (next && next != pipe_read_level)
+  {
+    read_job.first = pipe_read_pos;
+    read_job.last  = next->next;
+
+    PipeReadWorker(&read_job);
+    PipeFinishJob(&read_thread, &read_job);
+
+    pipe_read_pos = next->next;
+    pipe_read_level = next;
+  }
+
+  PipeFinishJob(&write_thread, &write_job);
+
+  // write out the finished level.  After the last level, the rest
+  // is left to WriteWadFile() since it may not be loaded yet.
+  if (wad.current_level && next)
+  {
+    write_job.first = pipe_write_pos;
+    write_job.last  = next;
+
+    pipe_write_pos = next;
+
+    write_thread = ThreadStart(PipeWriteWorker, &write_job);
+  }
+
+  if (! next)
+    return;
+
+  // prefetch the level after this one
+  for (after=next->next; after; after=after->next)
+  {
+    if (after->lev_info && ! (after->lev_info->flags & LEVEL_IS_GL))
+      break;
+  }
+
+  if (after)
+  {
+    read_job.first = pipe_read_pos;
+    read_job.last  = after->next;
+
+    pipe_read_pos = after->next;
+    pipe_read_level = after;
+
+    read_thread = ThreadStart(PipeReadWorker, &read_job);
+  }
+}
+
+//
+// FinishPipeline
+//
+static void FinishPipeline(void)
+{
+  int check;
+
+  PipeFinishJob(&read_thread,  &read_job);
+  PipeFinishJob(&write_thread, &write_job);
+
+  // handle the lumps after the last level
+  read_job.first = pipe_read_pos;
+  read_job.last  = NULL;
+
+  PipeReadWorker(&read_job);
+  PipeFinishJob(&read_thread, &read_job);
+
+  if (pipe_read_entries != pipe_dir_entries)
+    InternalError("Read directory count consistency failure (%d,%d)",
+      pipe_read_entries, pipe_dir_entries);
+
+  write_job.first = pipe_write_pos;
+  write_job.last  = NULL;
+
+  PipeWriteWorker(&write_job);
+  PipeFinishJob(&write_thread, &write_job);
+
+  fflush(out_file);
+
+  wad.num_entries = pipe_entries;
+  wad.dir_start   = pipe_offset;
+
+  check = WriteDirectory();
+
+  if (check != wad.num_entries)
+    InternalError("Write directory count consistency failure (%d,%d)",
+      check, wad.num_entries);
+
+  // now the header can be filled in
+  fseek(out_file, 0, SEEK_SET);
+
+  WriteHeader();
+
+  fflush(out_file);
+
+  UtilFree(pipe_filename);
+  pipe_filename = NULL;
+}
+
+//
+// AbortPipeline
+//
+// Stops the helper threads.  An incomplete output file is removed.
+//
+static void AbortPipeline(void)
+{
+  PipeFinishJob(&read_thread,  &read_job);
+  PipeFinishJob(&write_thread, &write_job);
+
+  if (out_file)
+  {
+    fclose(out_file);
+    out_file = NULL;
+  }
+
+  if (pipe_filename)
+  {
+    remove(pipe_filename);
+
+    UtilFree(pipe_filename);
+    pipe_filename = NULL;
+  }
+
+  pipe_active = FALSE;
+}
+
+
 /* ---------------------------------------------------------------- */
 
 
@@ -1138,7 +1669,8 @@ void AppendLevelLump(lump_t *lump, const void *data, int length)
   }
   else if (lump->space < length)
   {
-    lump->space = MAX(length, APPEND_BLKSIZE);
+    // grow geometrically, many small appends are common
+    lump->space = MAX(length, MAX(lump->length, APPEND_BLKSIZE));
     lump->data = UtilRealloc(lump->data, lump->length + lump->space);
   }
 
@@ -1149,6 +1681,31 @@ void AppendLevelLump(lump_t *lump, const void *data, int length)
 }
 
 
+//
+// ExtendLevelLump
+//
+void *ExtendLevelLump(lump_t *lump, int length)
+{
+  void *pos;
+
+  if (length == 0)
+    return NULL;
+
+  if (lump->space < length)
+  {
+    lump->data = UtilRealloc(lump->data, lump->length + length);
+    lump->space = length;
+  }
+
+  pos = ((char *)lump->data) + lump->length;
+
+  lump->length += length;
+  lump->space  -= length;
+
+  return pos;
+}
+
+
 //
 // AddGLTextLine
 //
@@ -1174,6 +1731,47 @@ void AddGLTextLine(const char *keyword, const char *value)
 }
 
 
+//
+// FindGLTextValue
+//
+// Looks for "keyword=value" in the text of a GL level marker, and
+// returns a copy of the value (or NULL if not present).
+//
+static char *FindGLTextValue(const char *text, const char *keyword)
+{
+  int key_len = strlen(keyword);
+
+  while (*text)
+  {
+    int len = strcspn(text, "\r\n");
+
+    if (len > key_len && text[key_len] == '=' &&
+        strncmp(text, keyword, key_len) == 0)
+    {
+      return UtilStrNDup(text + key_len + 1, len - key_len - 1);
+    }
+
+    text += len;
+    text += strspn(text, "\r\n");
+  }
+
+  return NULL;
+}
+
+//
+// GetOldGLValue
+//
+char *GetOldGLValue(const char *keyword)
+{
+  const char *text = wad.current_level->lev_info->old_gl_text;
+
+  if (! text)
+    return NULL;
+
+  return FindGLTextValue(text, keyword);
+}
+
+
 //
 // CountLevels
 //
@@ -1206,6 +1804,9 @@ int FindNextLevel(void)
   while (cur && ! (cur->lev_info && ! (cur->lev_info->flags & LEVEL_IS_GL)))
     cur=cur->next;
 
+  if (pipe_active)
+    PipeAdvance(cur);
+
   wad.current_level = cur;
 
   return (cur != NULL);
@@ -1292,6 +1893,27 @@ glbsp_ret_e ReadWadFile(const char *filename)
   // read directory
   ReadDirectory();
 
+  // the pipeline reads and writes lumps while the levels are being
+  // built, which cannot work when overwriting the input file.
+  pipe_active = FALSE;
+
+  if (ThreadCount() > 1 && ! cur_info->same_filenames)
+  {
+    copy_file = fopen(filename, "rb");
+
+    if (copy_file)
+    {
+      pipe_active = TRUE;
+      wad.current_level = NULL;
+
+      // the lumps are read later, see FinishPipeline()
+      pipe_dir_entries  = wad.num_entries;
+      pipe_read_entries = 0;
+
+      return GLBSP_E_OK;
+    }
+  }
+
   DisplayOpen(DIS_FILEPROGRESS);
   DisplaySetTitle("glBSP Reading Wad");
   
@@ -1334,6 +1956,14 @@ glbsp_ret_e WriteWadFile(const char *filename)
   if (cur_info->gwa_mode)
     wad.kind = PWAD;
 
+  if (pipe_active)
+  {
+    FinishPipeline();
+    return GLBSP_E_OK;
+  }
+
+  ZLibWait();
+
   RecomputeDirectory();
 
   // create output wad file & write the header
@@ -1378,6 +2008,41 @@ glbsp_ret_e WriteWadFile(const char *filename)
 }
 
 
+//
+// StartPipeline
+//
+glbsp_ret_e StartPipeline(const char *filename)
+{
+  if (! pipe_active)
+    return GLBSP_E_OK;
+
+  out_file = fopen(filename, "wb");
+
+  if (! out_file)
+  {
+    SetErrorMsg("Cannot create WAD file: %s [%s]", filename,
+        strerror(errno));
+
+    pipe_active = FALSE;
+    return GLBSP_E_WriteError;
+  }
+
+  pipe_filename = UtilStrDup(filename);
+
+  // the real header is written once the directory is known
+  WriteHeader();
+
+  pipe_offset  = sizeof(raw_wad_header_t);
+  pipe_entries = 0;
+
+  pipe_read_pos   = wad.dir_head;
+  pipe_read_level = NULL;
+  pipe_write_pos  = wad.dir_head;
+
+  return GLBSP_E_OK;
+}
+
+
 //
 // DeleteGwaFile
 //
@@ -1399,6 +2064,17 @@ void CloseWads(void)
 {
   int i;
 
+  if (pipe_active)
+    AbortPipeline();
+
+  ZLibWait();
+
+  if (copy_file)
+  {
+    fclose(copy_file);
+    copy_file = NULL;
+  }
+
   if (in_file)
   {
     fclose(in_file);
@@ -1429,98 +2105,166 @@ void CloseWads(void)
     UtilFree((void *)wad.level_names);
     wad.level_names = NULL;
   }
+
+  FreeNameIndex();
 }
 
 
 /* ---------------------------------------------------------------- */
 
-static lump_t  *zout_lump;
-static z_stream zout_stream;
-static Bytef    zout_buffer[1024];
+static lump_t *zout_lump;
+
+// compression of the previous lump, when done in the background
+// (threads are enabled but the pipeline isn't being used).
+static thread_t *zlib_thread = NULL;
 
 //
-// ZLibBeginLump
+// DeflateLump
 //
-void ZLibBeginLump(lump_t *lump)
+// Compresses the lump's data from 'deflate_start' onwards (the part
+// before that is kept as is).  The output goes straight into a new
+// buffer sized by deflateBound(), so zlib finishes in one call.
+// Safe to use on the pipeline threads: instead of calling FatalError,
+// returns a message when something went wrong (leaving the lump
+// uncompressed), otherwise NULL.
+//
+static const char *DeflateLump(lump_t *lump)
 {
-  zout_lump = lump;
+  z_stream zs;
+  uLong out_len;
 
-  zout_stream.zalloc = (alloc_func)0;
-  zout_stream.zfree  = (free_func)0;
-  zout_stream.opaque = (voidpf)0;
+  uint8_g *raw = (uint8_g *) lump->data;
+  uint8_g *out;
+  int raw_len = lump->length - lump->deflate_start;
 
-  if (Z_OK != deflateInit(&zout_stream, Z_DEFAULT_COMPRESSION))
-    FatalError("Trouble setting up zlib compression");
+  lump->flags &= ~LUMP_DEFLATE_ME;
 
-  zout_stream.next_out  = zout_buffer;
-  zout_stream.avail_out = sizeof(zout_buffer);
-}
+  memset(&zs, 0, sizeof(zs));
 
-//
-// ZLibAppendLump
-//
-void ZLibAppendLump(const void *data, int length)
-{
-  // ASSERT(zout_lump)
-  // ASSERT(length > 0)
+  if (Z_OK != deflateInit(&zs, cur_info->zlib_level))
+    return "Trouble setting up zlib compression\n";
 
-  zout_stream.next_in  = (Bytef*)data;   // const override
-  zout_stream.avail_in = length;
+  out_len = deflateBound(&zs, (uLong) raw_len);
+  out = (uint8_g *) calloc(1, lump->deflate_start + (int) out_len);
 
-  while (zout_stream.avail_in > 0)
+  if (! out)
   {
-    int err = deflate(&zout_stream, Z_NO_FLUSH);
+    deflateEnd(&zs);
+    return "Out of memory for zlib compression\n";
+  }
 
-    if (err != Z_OK)
-      FatalError("Trouble compressing %d bytes (zlib)\n", length);
+  if (lump->deflate_start > 0)
+    memcpy(out, raw, lump->deflate_start);
 
-    if (zout_stream.avail_out == 0) 
-    {
-      AppendLevelLump(zout_lump, zout_buffer, sizeof(zout_buffer));
+  zs.next_in   = raw + lump->deflate_start;
+  zs.avail_in  = raw_len;
+  zs.next_out  = out + lump->deflate_start;
+  zs.avail_out = out_len;
 
-      zout_stream.next_out  = zout_buffer;
-      zout_stream.avail_out = sizeof(zout_buffer);
-    }
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+  {
+    deflateEnd(&zs);
+    free(out);
+    return "Trouble compressing lump (zlib)\n";
   }
+
+  // 'space' is the room left after 'length'
+  lump->data   = out;
+  lump->length = lump->deflate_start + (int) zs.total_out;
+  lump->space  = (int) (out_len - zs.total_out);
+
+  deflateEnd(&zs);
+
+  if (raw)
+    UtilFree(raw);
+
+  return NULL;
 }
 
+// problem from the background compression, reported by ZLibWait()
+static const char *zlib_trouble = NULL;
+
 //
-// ZLibFinishLump
+// DeflateWorker
 //
-void ZLibFinishLump(void)
+static void DeflateWorker(void *data)
 {
-  int left_over;
-
-  // ASSERT(zout_stream.avail_out > 0)
+  zlib_trouble = DeflateLump((lump_t *) data);
+}
 
-  zout_stream.next_in  = Z_NULL;
-  zout_stream.avail_in = 0;
+//
+// ZLibWait
+//
+// Waits for any background compression to finish.
+//
+static void ZLibWait(void)
+{
+  if (zlib_thread)
+  {
+    ThreadJoin(zlib_thread);
+    zlib_thread = NULL;
+  }
 
-  for (;;)
+  if (zlib_trouble)
   {
-    int err = deflate(&zout_stream, Z_FINISH);
+    const char *msg = zlib_trouble;
 
-    if (err == Z_STREAM_END)
-      break;
+    zlib_trouble = NULL;
+    FatalError("%s", msg);
+  }
+}
 
-    if (err != Z_OK)
-      FatalError("Trouble finishing compression (zlib)\n");
+//
+// ZLibBeginLump
+//
+void ZLibBeginLump(lump_t *lump)
+{
+  zout_lump = lump;
 
-    if (zout_stream.avail_out == 0) 
-    {
-      AppendLevelLump(zout_lump, zout_buffer, sizeof(zout_buffer));
+  lump->deflate_start = lump->length;
+}
 
-      zout_stream.next_out  = zout_buffer;
-      zout_stream.avail_out = sizeof(zout_buffer);
-    }
+//
+// ZLibAppendLump
+//
+// The data is collected uncompressed, and compressed in one go when
+// the lump is finished: on the pipeline's writer thread, on a thread
+// of its own while the next level is built, or right away when
+// threads are disabled.
+//
+void ZLibAppendLump(const void *data, int length)
+{
+  // ASSERT(zout_lump)
+  // ASSERT(length > 0)
+
+  AppendLevelLump(zout_lump, data, length);
+}
+
+//
+// ZLibFinishLump
+//
+void ZLibFinishLump(void)
+{
+  zout_lump->flags |= LUMP_DEFLATE_ME;
+
+  if (pipe_active)
+  {
+    // the writer thread will do it
   }
+  else if (ThreadCount() > 1)
+  {
+    ZLibWait();
 
-  left_over = sizeof(zout_buffer) - zout_stream.avail_out;
+    zlib_thread = ThreadStart(DeflateWorker, zout_lump);
+  }
+  else
+  {
+    const char *msg = DeflateLump(zout_lump);
 
-  if (left_over > 0)
-    AppendLevelLump(zout_lump, zout_buffer, left_over);
+    if (msg)
+      FatalError("%s", msg);
+  }
 
-  deflateEnd(&zout_stream);
   zout_lump = NULL;
 }
 
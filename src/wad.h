@@ -72,6 +72,9 @@ typedef struct level_s
   int soft_limit;
   int hard_limit;
   int v5_switch;
+
+  // text of the GL marker left by a previous build, or NULL
+  char *old_gl_text;
 }
 level_t;
 
@@ -126,6 +129,9 @@ typedef struct lump_s
 
   // level information, usually NULL
   level_t *lev_info;
+
+  // offset where zlib compression begins (see LUMP_DEFLATE_ME)
+  int deflate_start;
 }
 lump_t;
 
@@ -141,6 +147,9 @@ lump_t;
 /* this lump is new (didn't exist in the original) */
 #define LUMP_NEW           0x0200
 
+/* this lump still needs to be compressed (from 'deflate_start') */
+#define LUMP_DEFLATE_ME    0x0400
+
 
 /* ----- function prototypes --------------------- */
 
@@ -156,7 +165,8 @@ char *ReplaceExtension(const char *filename, const char *ext);
 
 // open the input wad file and read the contents into memory.  When
 // 'load_all' is false, lumps other than level info will be marked as
-// copyable instead of loaded.
+// copyable instead of loaded.  When the pipeline is used (see below)
+// only the directory is read here.
 //
 // Returns GLBSP_E_OK if all went well, otherwise an error code (in
 // which case cur_comms->message has been set and all files/memory
@@ -174,6 +184,18 @@ glbsp_ret_e ReadWadFile(const char *filename);
 //
 glbsp_ret_e WriteWadFile(const char *filename);
 
+// open the output wad file and begin the read/build/write pipeline.
+// From now on FindNextLevel() prefetches the lumps of the following
+// level and writes out the previous (finished) level on helper
+// threads, and WriteWadFile() merely writes what remains and the
+// directory.  Does nothing when the pipeline is not being used
+// (single thread, or the output file is the input file).
+//
+// Returns GLBSP_E_OK if all went well, otherwise an error code (in
+// which case cur_comms->message has been set).
+//
+glbsp_ret_e StartPipeline(const char *filename);
+
 // close all wad files and free any memory.
 void CloseWads(void);
 
@@ -216,11 +238,26 @@ lump_t *CreateGLLump(const char *name);
 //
 void AppendLevelLump(lump_t *lump, const void *data, int length);
 
+// grow the given level lump by exactly 'length' bytes and return a
+// pointer to the new (uninitialised) space, so that records can be
+// encoded straight into the lump.  Returns NULL for zero length.
+//
+void *ExtendLevelLump(lump_t *lump, int length);
+
 // for the current GL lump, add a keyword/value pair into the
 // level marker lump.
 void AddGLTextLine(const char *keyword, const char *value);
 
-// Zlib compression support
+// return the value of a keyword in the GL marker that a previous
+// build left for the current level, or NULL if there is no such
+// keyword.  The result must be freed with UtilFree().
+//
+char *GetOldGLValue(const char *keyword);
+
+// Zlib compression support.  The level comes from the -zlevel
+// option, where 0 means store only.
+#define DEFAULT_ZLIB_LEVEL  6
+
 void ZLibBeginLump(lump_t *lump);
 void ZLibAppendLump(const void *data, int length);
 void ZLibFinishLump(void);
@@ -0,0 +1,421 @@
+#!/usr/bin/env python3
+#
+# regress.py : glBSP regression tests
+#
+# Usage: python3 tests/regress.py [path/to/glbsp] [--update]
+#
+# The test levels are made by wadgen.py into a temporary directory,
+# built with glbsp, and then checked.  Returns non-zero on failure.
+#
+# The lumps built with a set of common options are also compared with
+# the ones recorded in expected.txt, and must not depend on how many
+# threads are used.  When the output changes on purpose, run with
+# --update to record the new lumps (and say why in the commit).
+#
+
+import hashlib
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import wadgen
+
+
+EXPECTED = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        'expected.txt')
+
+failures = []
+
+
+def check(cond, what):
+    if cond:
+        print("  ok      %s" % what)
+    else:
+        print("  FAILED  %s" % what)
+        failures.append(what)
+
+
+def run_glbsp(glbsp, in_wad, out_wad, options):
+    proc = subprocess.run([glbsp] + options + [in_wad, '-o', out_wad],
+                          stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                          universal_newlines=True)
+
+    if proc.returncode != 0:
+        print(proc.stdout)
+
+    check(proc.returncode == 0, ' '.join(['glbsp'] + options + ['runs']))
+
+    return proc.stdout
+
+
+def seg_linedefs(lumps):
+    """Returns the set of linedefs which have segs in a normal SEGS lump."""
+    data = lumps['SEGS']
+
+    return set(struct.unpack('<hhhhhh', data[i:i+12])[3]
+               for i in range(0, len(data), 12))
+
+
+def c_div(a, b):
+    """Integer division truncating towards zero, like C."""
+    q = abs(a) // abs(b)
+    return q if (a < 0) == (b < 0) else -q
+
+
+def line_touches_box(xmin, ymin, xmax, ymax, x1, y1, x2, y2):
+    """The line clipping test of the original per-block blockmap code
+    (CheckLinedefInsideBox), with the same integer truncation."""
+    count = 2
+
+    while True:
+        if y1 > ymax:
+            if y2 > ymax:
+                return False
+            x1 = x1 + int((x2-x1) * float(ymax-y1) / float(y2-y1))
+            y1 = ymax
+            count = 2
+            continue
+
+        if y1 < ymin:
+            if y2 < ymin:
+                return False
+            x1 = x1 + int((x2-x1) * float(ymin-y1) / float(y2-y1))
+            y1 = ymin
+            count = 2
+            continue
+
+        if x1 > xmax:
+            if x2 > xmax:
+                return False
+            y1 = y1 + int((y2-y1) * float(xmax-x1) / float(x2-x1))
+            x1 = xmax
+            count = 2
+            continue
+
+        if x1 < xmin:
+            if x2 < xmin:
+                return False
+            y1 = y1 + int((y2-y1) * float(xmin-x1) / float(x2-x1))
+            x1 = xmin
+            count = 2
+            continue
+
+        count -= 1
+
+        if count == 0:
+            return True
+
+        x1, x2 = x2, x1
+        y1, y2 = y2, y1
+
+
+def reference_blocks(lumps, bx0, by0, bw, bh):
+    """Works out the line list of every block the old way, by testing
+    each block in the bounding box of each linedef."""
+    verts = lumps['VERTEXES']
+    lines = lumps['LINEDEFS']
+
+    def vertex(v):
+        return struct.unpack('<hh', verts[v*4 : v*4+4])
+
+    blocks = [[] for i in range(bw * bh)]
+
+    for index in range(len(lines) // 14):
+        v1, v2 = struct.unpack('<HH', lines[index*14 : index*14+4])
+
+        x1, y1 = vertex(v1)
+        x2, y2 = vertex(v2)
+
+        if x1 == x2 and y1 == y2:
+            continue
+
+        bx1 = max(c_div(min(x1, x2) - bx0, 128), 0)
+        by1 = max(c_div(min(y1, y2) - by0, 128), 0)
+        bx2 = min(c_div(max(x1, x2) - bx0, 128), bw - 1)
+        by2 = min(c_div(max(y1, y2) - by0, 128), bh - 1)
+
+        for by in range(by1, by2 + 1):
+            for bx in range(bx1, bx2 + 1):
+                minx = bx0 + bx * 128
+                miny = by0 + by * 128
+
+                # horizontal and vertical lines take every block
+                if (by1 == by2 or bx1 == bx2 or
+                    line_touches_box(minx, miny, minx + 127, miny + 127,
+                                     x1, y1, x2, y2)):
+                    blocks[by * bw + bx].append(index)
+
+    return [sorted(b) for b in blocks]
+
+
+def blockmap_blocks(data):
+    """Decodes a BLOCKMAP lump into its origin, size and the sorted
+    line list of each block (skipping the first entry, like ports)."""
+    words = struct.unpack('<%dH' % (len(data) // 2), data)
+
+    bx0, by0 = struct.unpack('<hh', data[0:4])
+    bw, bh = words[2], words[3]
+
+    blocks = []
+
+    for i in range(bw * bh):
+        pos = words[4 + i] + 1
+        lst = []
+
+        while words[pos] != 0xFFFF:
+            lst.append(words[pos])
+            pos += 1
+
+        blocks.append(sorted(lst))
+
+    return bx0, by0, bw, bh, blocks
+
+
+# ----- the tests -------------------------------------------------
+
+def test_back_to_back(glbsp, tmp):
+    print("back-to-back rooms:")
+
+    lev = wadgen.back_to_back()
+
+    in_wad  = os.path.join(tmp, 'b2b.wad')
+    out_wad = os.path.join(tmp, 'b2b_out.wad')
+
+    wadgen.write_wad(in_wad, [('MAP01', lev)])
+
+    log = run_glbsp(glbsp, in_wad, out_wad, ['-w'])
+
+    lumps = dict(wadgen.read_wad(out_wad))
+
+    check('overlapped' not in log, "walls facing apart are not overlaps")
+    check('not closed' not in log, "all subsectors are closed")
+    check(seg_linedefs(lumps) == set(range(len(lev.lines))),
+          "every wall has segs")
+
+
+def test_split_wall(glbsp, tmp):
+    print("overlapping pieces of one wall:")
+
+    in_wad  = os.path.join(tmp, 'split.wad')
+    out_wad = os.path.join(tmp, 'split_out.wad')
+
+    wadgen.write_wad(in_wad, [('MAP01', wadgen.split_wall())])
+
+    log = run_glbsp(glbsp, in_wad, out_wad, ['-w'])
+
+    check('Detected 2 overlapped linedefs' in log, "covered pieces are found")
+    check('Detected 2 partly overlapped linedefs' in log,
+          "partly covered pieces are found")
+    check('not closed' not in log, "all subsectors are closed")
+
+
+def test_blockmap(glbsp, tmp):
+    print("blockmap line lists:")
+
+    in_wad = os.path.join(tmp, 'blocks.wad')
+
+    wadgen.write_wad(in_wad, [('MAP01', wadgen.grid(7, 30, 24, 96, 40, 0.1)),
+                              ('MAP02', wadgen.grid(8, 12, 40, 160, 70, 0.2))])
+
+    for options in [[], ['-blocktail']]:
+        out_wad = os.path.join(tmp, 'blocks_out.wad')
+
+        run_glbsp(glbsp, in_wad, out_wad, options)
+
+        lumps = wadgen.read_wad(out_wad)
+
+        for i, (name, data) in enumerate(lumps):
+            if name != 'BLOCKMAP':
+                continue
+
+            # the level marker comes before the level lumps
+            start = i
+            while lumps[start][0] in wadgen.LEVEL_LUMPS:
+                start -= 1
+
+            level = dict(lumps[start + 1 : i])
+
+            bx0, by0, bw, bh, blocks = blockmap_blocks(data)
+
+            check(blocks == reference_blocks(level, bx0, by0, bw, bh),
+                  ' '.join([lumps[start][0], 'lists match the old way'] +
+                           options))
+
+
+def test_keep_lumps(glbsp, tmp):
+    print("keeping unchanged lumps:")
+
+    in_wad   = os.path.join(tmp, 'keep.wad')
+    out_wad  = os.path.join(tmp, 'keep_out.wad')
+    out_wad2 = os.path.join(tmp, 'keep_out2.wad')
+
+    wadgen.write_wad(in_wad, [('MAP01', wadgen.grid(3, 10, 8, 128, 30, 0.1))])
+
+    run_glbsp(glbsp, in_wad, out_wad, ['-reject', 'normal'])
+
+    marker = dict(wadgen.read_wad(out_wad))['GL_MAP01'].decode('latin-1')
+
+    check(re.search(r'^BLOCKMAP_SUM=0x[0-9a-f]{16}$', marker, re.M) and
+          re.search(r'^REJECT_SUM=0x[0-9a-f]{16}$', marker, re.M),
+          "the marker holds 64-bit input checksums")
+
+    log = run_glbsp(glbsp, out_wad, out_wad2, ['-n', '-reject', 'normal'])
+
+    check('Kept unchanged blockmap' in log and
+          'Kept unchanged reject' in log, "a rebuild keeps both lumps")
+
+    log = run_glbsp(glbsp, out_wad, out_wad2,
+                    ['-n', '-reject', 'full', '-bt'])
+
+    check('Kept unchanged' not in log, "other options rebuild both lumps")
+
+
+# the option sets for the recorded output.  Each is built with one
+# thread and with several (which also pipelines the reading, building
+# and writing of the levels).
+#
+# When first recorded, the output of the cases which the original
+# 2.27 code supports matched it in every lump apart from BLOCKMAP (the
+# lists are now laid out in block order, see test_blockmap), the
+# normal SEGS, SSECTORS and ZDoom NODES (collinear segs are joined),
+# and the GL level markers (which hold new lines).
+OUTPUT_CASES = [
+    ('default',  []),
+    ('v5',       ['-v5']),
+    ('v1_mpuy',  ['-v1', '-m', '-p', '-u', '-y']),
+    ('v3_xr',    ['-v3', '-loadall', '-xr']),
+    ('noprune',  ['-xu']),
+    ('normal',   ['-n', '-blocktail']),
+    ('rej_norm', ['-reject', 'normal']),
+    ('rej_full', ['-reject', 'full', '-rejectdist', '1024']),
+    ('boundary', ['-strategy', 'boundary', '-f']),
+    ('gwa',      []),
+]
+
+
+GL_DATA_LUMPS = ['GL_VERT', 'GL_SEGS', 'GL_SSECT', 'GL_NODES', 'GL_PVS']
+
+
+def lump_sums(path):
+    sums = []
+
+    for name, data in wadgen.read_wad(path):
+        # the GL level markers say when they were built
+        if name.startswith('GL_') and name not in GL_DATA_LUMPS:
+            data = re.sub(rb'TIME=[^\n]*\n', b'', data)
+
+        sums.append((name, hashlib.md5(data).hexdigest()))
+
+    return sums
+
+
+def read_expected():
+    expected = {}
+
+    if os.path.exists(EXPECTED):
+        with open(EXPECTED) as f:
+            for line in f:
+                if line.startswith('#') or not line.strip():
+                    continue
+
+                case, name, digest = line.split()
+                expected.setdefault(case, []).append((name, digest))
+
+    return expected
+
+
+def write_expected(results):
+    with open(EXPECTED, 'w') as f:
+        f.write('# lumps built by tests/regress.py: case, lump, md5\n')
+
+        for case, _ in OUTPUT_CASES:
+            for name, digest in results[case]:
+                f.write('%s %s %s\n' % (case, name, digest))
+
+
+def test_outputs(glbsp, tmp, update):
+    print("recorded output:")
+
+    in_wad = os.path.join(tmp, 'levels.wad')
+
+    wadgen.write_wad(in_wad, [('MAP01', wadgen.grid(11, 24, 20, 128, 30, 0.1)),
+                              ('MAP02', wadgen.grid(12, 30, 16, 96, 20, 0.25)),
+                              ('E1M1',  wadgen.grid(13, 12, 12, 192, 50, 0.0))])
+
+    expected = read_expected()
+    results = {}
+
+    for case, options in OUTPUT_CASES:
+        ext = '.gwa' if case == 'gwa' else '.wad'
+        sums = []
+
+        for threads in ['1', '4']:
+            out_wad = os.path.join(tmp, 'out_%s_%s%s' % (case, threads, ext))
+
+            run_glbsp(glbsp, in_wad, out_wad,
+                      ['-threads', threads] + options)
+
+            sums.append(lump_sums(out_wad))
+
+        check(sums[0] == sums[1],
+              "%s output is the same with 1 and 4 threads" % case)
+
+        results[case] = sums[0]
+
+        if update:
+            continue
+
+        if case not in expected:
+            check(False, "%s output is recorded" % case)
+            continue
+
+        diffs = sorted(set(name for (name, a), (_, b)
+                           in zip(sums[0], expected[case]) if a != b))
+
+        if len(sums[0]) != len(expected[case]):
+            diffs.append('(number of lumps)')
+
+        check(not diffs, "%s output matches %s" % (case,
+              'the recorded lumps' if not diffs else ' '.join(diffs)))
+
+    if update:
+        write_expected(results)
+        print("  wrote %s" % EXPECTED)
+
+
+TESTS = [
+    test_back_to_back,
+    test_split_wall,
+    test_blockmap,
+    test_keep_lumps,
+]
+
+
+def main():
+    args = [a for a in sys.argv[1:] if a != '--update']
+    update = (len(args) != len(sys.argv) - 1)
+
+    glbsp = args[0] if args else './glbsp'
+    glbsp = os.path.abspath(glbsp)
+
+    with tempfile.TemporaryDirectory(prefix='glbsp_test') as tmp:
+        for test in TESTS:
+            test(glbsp, tmp)
+
+        test_outputs(glbsp, tmp, update)
+
+    if failures:
+        print("\n%d check(s) FAILED" % len(failures))
+        return 1
+
+    print("\nAll checks passed.")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,231 @@
+#
+# wadgen.py : makes small test levels for the glBSP regression tests
+#
+# The levels are made from code (instead of being stored in the repo)
+# so that each one stays easy to read and to change.
+#
+
+import random
+import struct
+
+
+class Level:
+    def __init__(self):
+        self.vertices = []
+        self.lines = []
+        self.sides = []
+        self.sectors = []
+        self.things = []
+        self.vert_map = {}
+
+    def vertex(self, x, y):
+        if (x, y) not in self.vert_map:
+            self.vert_map[(x, y)] = len(self.vertices)
+            self.vertices.append((x, y))
+        return self.vert_map[(x, y)]
+
+    def sector(self, floor=0, ceil=128, light=160):
+        self.sectors.append((floor, ceil, light))
+        return len(self.sectors) - 1
+
+    def side(self, sec, tex='STARTAN3'):
+        self.sides.append((0, 0, b'-', b'-', tex.encode(), sec))
+        return len(self.sides) - 1
+
+    def line(self, p1, p2, right, left=None):
+        """Adds a linedef from p1 to p2.  'right' and 'left' are
+        sector numbers, the left one is None for a one-sided line."""
+        v1 = self.vertex(*p1)
+        v2 = self.vertex(*p2)
+
+        if left is None:
+            self.lines.append((v1, v2, 1, 0, 0, self.side(right), 0xFFFF))
+        else:
+            self.lines.append((v1, v2, 4, 0, 0,
+                self.side(right, '-'), self.side(left, '-')))
+
+        return len(self.lines) - 1
+
+    def room(self, points, sec):
+        """Adds one-sided walls around a room, the points going
+        clockwise so that the room is on the right of each wall."""
+        for i in range(len(points)):
+            self.line(points[i], points[(i+1) % len(points)], sec)
+
+    def thing(self, x, y, kind=1):
+        self.things.append((x, y, 0, kind, 7))
+
+    def lumps(self):
+        return {
+            'THINGS':   b''.join(struct.pack('<hhhhh', *t)
+                                 for t in self.things),
+            'LINEDEFS': b''.join(struct.pack('<HHhhhHH', *l)
+                                 for l in self.lines),
+            'SIDEDEFS': b''.join(struct.pack('<hh8s8s8sh', *s)
+                                 for s in self.sides),
+            'VERTEXES': b''.join(struct.pack('<hh', *v)
+                                 for v in self.vertices),
+            'SECTORS':  b''.join(struct.pack('<hh8s8shhh', f, c,
+                                 b'FLOOR4_8', b'CEIL3_5', l, 0, 0)
+                                 for f, c, l in self.sectors),
+        }
+
+
+LEVEL_LUMPS = ['THINGS', 'LINEDEFS', 'SIDEDEFS', 'VERTEXES', 'SEGS',
+               'SSECTORS', 'NODES', 'SECTORS', 'REJECT', 'BLOCKMAP']
+
+
+def write_wad(path, levels, extra=True):
+    """Writes a PWAD with the given (name, Level) pairs.  With 'extra',
+    a few non-level lumps are added around the levels."""
+    entries = []
+    data = bytearray()
+
+    def add(name, blob):
+        entries.append((12 + len(data), len(blob), name))
+        data.extend(blob)
+
+    if extra:
+        add('PLAYPAL', bytes(range(256)) * 3)
+
+    for name, lev in levels:
+        lumps = lev.lumps()
+
+        add(name, b'')
+
+        for k in LEVEL_LUMPS:
+            add(k, lumps.get(k, b''))
+
+        if extra:
+            add('DEHACKED', b'test ' + name.encode())
+
+    directory = b''.join(struct.pack('<ii8s', ofs, length, name.encode())
+                         for ofs, length, name in entries)
+
+    with open(path, 'wb') as f:
+        f.write(b'PWAD' + struct.pack('<ii', len(entries), 12 + len(data)))
+        f.write(data)
+        f.write(directory)
+
+
+def read_wad(path):
+    """Returns the directory of a wad as a list of (name, data)."""
+    with open(path, 'rb') as f:
+        raw = f.read()
+
+    count, ofs = struct.unpack('<ii', raw[4:12])
+    result = []
+
+    for i in range(count):
+        start, length, name = struct.unpack('<ii8s',
+                raw[ofs + 16*i : ofs + 16*i + 16])
+        name = name.rstrip(b'\0').decode('latin-1')
+        result.append((name, raw[start : start + length]))
+
+    return result
+
+
+# ----- the test levels -------------------------------------------
+
+def back_to_back():
+    """Two one-sided rooms meeting back-to-back.  The wall of the
+    south room lies along the whole wall of the north room, but they
+    face opposite ways, so both need segs."""
+    lev = Level()
+
+    north = lev.sector()
+    south = lev.sector()
+
+    lev.room([(100, 0), (0, 0), (0, 100), (100, 100)], north)
+    lev.room([(-20, 0), (120, 0), (120, -100), (-20, -100)], south)
+
+    lev.thing(50, 50)
+    lev.thing(50, -50, 2)
+
+    return lev
+
+
+def split_wall():
+    """A room whose south wall is drawn as pieces which overlap each
+    other.  Each part of the wall should only get segs once."""
+    lev = Level()
+
+    sec = lev.sector()
+
+    lev.line((0, 0), (0, 128), sec)
+    lev.line((0, 128), (128, 128), sec)
+    lev.line((128, 128), (128, 0), sec)
+
+    # the pieces of the south wall, two partly and two fully covered
+    lev.line((80, 0), (0, 0), sec)
+    lev.line((112, 0), (40, 0), sec)
+    lev.line((128, 0), (100, 0), sec)
+    lev.line((72, 0), (48, 0), sec)
+    lev.line((108, 0), (76, 0), sec)
+
+    lev.thing(64, 64)
+
+    return lev
+
+
+def grid(seed, w, h, cell, jitter, holes):
+    """A grid of sectors with jittered corners and some missing
+    cells, giving plenty of splits, one-sided walls and REJECT work."""
+    rnd = random.Random(seed)
+    lev = Level()
+
+    corners = {}
+    alive = {}
+
+    def corner(i, j):
+        if (i, j) not in corners:
+            jx = jy = 0
+            if 0 < i < w and 0 < j < h:
+                jx = rnd.randint(-jitter, jitter)
+                jy = rnd.randint(-jitter, jitter)
+            corners[(i, j)] = ((i - w//2) * cell + jx,
+                               (j - h//2) * cell + jy)
+        return corners[(i, j)]
+
+    for j in range(h):
+        for i in range(w):
+            if rnd.random() >= holes:
+                alive[(i, j)] = lev.sector(rnd.randint(0, 64),
+                                           rnd.randint(128, 256))
+
+    # horizontal edges, with cell (i,j-1) below and (i,j) above
+    for j in range(h + 1):
+        for i in range(w):
+            a = alive.get((i, j-1))
+            b = alive.get((i, j))
+            p1, p2 = corner(i, j), corner(i+1, j)
+
+            if a is not None and b is not None:
+                lev.line(p1, p2, a, b)
+            elif a is not None:
+                lev.line(p1, p2, a)
+            elif b is not None:
+                lev.line(p2, p1, b)
+
+    # vertical edges, with cell (i-1,j) on the left and (i,j) right
+    for i in range(w + 1):
+        for j in range(h):
+            a = alive.get((i-1, j))
+            b = alive.get((i, j))
+            p1, p2 = corner(i, j), corner(i, j+1)
+
+            if a is not None and b is not None:
+                lev.line(p1, p2, b, a)
+            elif a is not None:
+                lev.line(p2, p1, a)
+            elif b is not None:
+                lev.line(p1, p2, b)
+
+    # an unused vertex, for the pruning code
+    lev.vertex(5, 5)
+
+    for (i, j), s in sorted(alive.items())[:8]:
+        x, y = corner(i, j)
+        lev.thing(x + cell//2, y + cell//2, 1 + (s % 4))
+
+    return lev